@@ -10,7 +10,10 @@
  * ========================================================================= */
 #include "Core.h"
 #include "CPU.h"
+#include "Dither.h"
 #include "Externs.h"
+#include "Helpers.h"
+#include "TCLod.h"
 
 #ifdef __cplusplus
 #include <cstdlib>
@@ -29,6 +32,7 @@ const char *RDPBuildType = "SSE4.1";
 #endif
 
 static void InitRDP(struct RDP *rdp);
+static void SelectISA(void);
 
 /* ============================================================================
  *  ConnectRDPToBus: Connects a RDP instance to a Bus instance.
@@ -74,6 +78,52 @@ InitRDP(struct RDP *rdp) {
   rdp->regs[DPC_STATUS_REG] |= 0x020; /* RDP PIPELINE is busy. */
   rdp->regs[DPC_STATUS_REG] |= 0x080; /* RDP COMMAND buffer is ready. */
 
+  SelectISA();
   rdp_init();
 }
 
+/* ============================================================================
+ *  SelectISA: Picks the best ISA build of the dispatched functions that
+ *  the host supports, and reports it through RDPBuildType. The dispatched
+ *  functions are the span renderers in Core.c and the Dither.c, Helpers.c
+ *  and TCLod.c kernels; the rest of Core.c stays on the base build.
+ * ========================================================================= */
+static void
+SelectISA(void) {
+#if defined(RDP_DISPATCH) && defined(__GNUC__)
+  static const char *ISANames[ISA_COUNT] = {NULL, "SSE4.1", "AVX2"};
+
+  static const DitherFuncTable *DitherFuncs[ISA_COUNT] = {
+    &DitherFuncs_base, &DitherFuncs_sse41, &DitherFuncs_avx2
+  };
+
+  static const HelperFuncTable *HelperFuncs[ISA_COUNT] = {
+    &HelperFuncs_base, &HelperFuncs_sse41, &HelperFuncs_avx2
+  };
+
+  static const TCLodFuncTable *TCLodFuncs[ISA_COUNT] = {
+    &TCLodFuncs_base, &TCLodFuncs_sse41, &TCLodFuncs_avx2
+  };
+
+  static const SpanFuncTable *SpanFuncs[ISA_COUNT] = {
+    &SpanFuncs_base, &SpanFuncs_sse41, &SpanFuncs_avx2
+  };
+
+  int isa = ISA_BASE;
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    isa = ISA_AVX2;
+  else if (__builtin_cpu_supports("sse4.1"))
+    isa = ISA_SSE41;
+
+  dither_funcs = DitherFuncs[isa];
+  helper_funcs = HelperFuncs[isa];
+  tclod_funcs = TCLodFuncs[isa];
+  span_funcs = SpanFuncs[isa];
+
+  if (ISANames[isa])
+    RDPBuildType = ISANames[isa];
+#endif
+}
+
@@ -59,6 +59,15 @@ typedef char bool;
 #define align(x)
 #endif
 
+/* ============================================================================
+ *  forceinline: Inlines a function regardless of the compiler's heuristics.
+ * ========================================================================= */
+#ifdef __GNUC__
+#define forceinline inline __attribute__ ((always_inline))
+#else
+#define forceinline inline
+#endif
+
 /* ============================================================================
  *  debug(x): Prints messages only when DNDEBUG is not defined.
  * ========================================================================= */
@@ -98,6 +107,30 @@ typedef char bool;
 #define unused(var)
 #endif
 
+/* ============================================================================
+ *  ISA_NAME(x): Dither.c, Helpers.c and TCLod.c are compiled once for each
+ *  ISA level (the base build plus, with RDP_DISPATCH, one build per extra
+ *  level; see the Makefile). Each build suffixes its definitions with the
+ *  level it targets, and SelectISA in CPU.c picks one set at start-up,
+ *  along with the matching copies of the Core.c span renderers.
+ * ========================================================================= */
+#define ISA_BASE 0
+#define ISA_SSE41 1
+#define ISA_AVX2 2
+#define ISA_COUNT 3
+
+#ifndef RDP_ISA
+#define RDP_ISA ISA_BASE
+#endif
+
+#if RDP_ISA == ISA_AVX2
+#define ISA_NAME(name) name##_avx2
+#elif RDP_ISA == ISA_SSE41
+#define ISA_NAME(name) name##_sse41
+#else
+#define ISA_NAME(name) name##_base
+#endif
+
 /* ============================================================================
  *  Host byte order swap functions.
  * ========================================================================= */
@@ -18,6 +18,7 @@
 #include "Externs.h"
 #include "FBAccess.h"
 #include "Helpers.h"
+#include "Interface.h"
 #include "Random.h"
 #include "Registers.h"
 #include "Tables.h"
@@ -71,8 +72,10 @@ int blshifta = 0, blshiftb = 0, pastblshifta = 0, pastblshiftb = 0;
 uint8_t* rdram_8;
 uint16_t* rdram_16;
 
-SPAN span[1024];
-uint32_t cvgbuf[1024];
+SPANBUF span align(16);
+uint8_t cvgbuf[1024];
+static int32_t cvgfull_start = 0;
+static uint32_t cvgfull_length = 0;
 
 enum SpanType {
   SPAN_DR,
@@ -117,12 +120,23 @@ typedef struct
   uint32_t flip;  
 } TEX_RECTANGLE;
 
+typedef void (*FetchTexelFunc)(COLOR *, int, int, uint32_t);
+typedef void (*FetchTexelQuadroFunc)(COLOR *, COLOR *, COLOR *, COLOR *,
+  int, int, int, int, uint32_t);
+
 typedef struct
 {
+  FetchTexelFunc fetch_texel;
+  FetchTexelQuadroFunc fetch_texel_quadro;
   int clampdiffs, clampdifft;
   int clampens, clampent;
   int masksclamped, masktclamped;
   int notlutswitch, tlutswitch;
+#ifdef USE_SSE
+  __m128i shl_s, shr_s, shl_t, shr_t;
+  __m128i relative, maxst, clampdiff;
+  __m128i clampen, wrapbit, maskbits, coupled;
+#endif
 } FAKETILE;
 
 typedef struct
@@ -266,6 +280,39 @@ static uint32_t ti_address = 0;
 
 static uint32_t zb_address = 0;
 
+#define HIZ_SHIFT 3
+#define HIZ_COLS  (1024 >> HIZ_SHIFT)
+#define HIZ_ROWS  (1024 >> HIZ_SHIFT)
+#define HIZ_NEVER 0x7fffffff
+
+static HIZBLOCK hiz[HIZ_ROWS * HIZ_COLS];
+static uint32_t hiz_generation = 1;
+static uint32_t hiz_primitive = 0;
+static uint32_t hiz_base = 0;
+static uint32_t hiz_width = 0;
+static int hiz_tracking = 0;
+static int hiz_enabled = 0;
+
+#define ZMIRROR_SHIFT  10
+#define ZMIRROR_BLOCKS 1024
+#define ZMIRROR_SIZE   (ZMIRROR_BLOCKS << ZMIRROR_SHIFT)
+#define ZBLOCK_EMPTY   0
+#define ZBLOCK_CLEAN   1
+#define ZBLOCK_DIRTY   2
+
+static uint32_t zmirror[ZMIRROR_SIZE] align(16);
+static uint8_t zmirror_state[ZMIRROR_BLOCKS];
+static uint32_t zmirror_base = 0;
+static uint32_t zmirror_span = 0;
+static uint32_t zmirror_first = ZMIRROR_BLOCKS, zmirror_last = 0;
+static int zmirror_enabled = 0;
+
+#define DIRTY_IMAGES 16
+
+static DIRTYRECT dirty[DIRTY_IMAGES];
+static DIRTYRECT* dirty_cur = NULL;
+static uint32_t dirty_clock = 0;
+
 static TILE tile[8];
 
 static RECTANGLE clip = {0,0,0x2000,0x2000};
@@ -280,12 +327,9 @@ uint8_t TMEM[0x1000];
 #define PIXELS_TO_BYTES(pix, siz) (((pix) << (siz)) >> 1)
 
 static void rdp_set_other_modes(uint32_t w1, uint32_t w2);
-static void fetch_texel(COLOR *color, int s, int t, uint32_t tilenum);
-static void fetch_texel_entlut(COLOR *color, int s, int t, uint32_t tilenum);
-static void fetch_texel_quadro(COLOR *color0, COLOR *color1, COLOR *color2, COLOR *color3, int s0, int s1, int t0, int t1, uint32_t tilenum);
-static void fetch_texel_entlut_quadro(COLOR *color0, COLOR *color1, COLOR *color2, COLOR *color3, int s0, int s1, int t0, int t1, uint32_t tilenum);
 void tile_tlut_common_cs_decoder(uint32_t w1, uint32_t w2);
 void loading_pipeline(int start, int end, int tilenum, int coord_quad, int ltlut);
+void loading_pipeline_rows(int start, int end, int tilenum);
 void get_tmem_idx(int s, int t, uint32_t tilenum, uint32_t* idx0, uint32_t* idx1, uint32_t* idx2, uint32_t* idx3, uint32_t* bit3flipped, uint32_t* hibit);
 void sort_tmem_idx(uint32_t *idx, uint32_t idxa, uint32_t idxb, uint32_t idxc, uint32_t idxd, uint32_t bankno);
 void sort_tmem_shorts_lowhalf(uint32_t* bindshort, uint32_t short0, uint32_t short1, uint32_t short2, uint32_t short3, uint32_t bankno);
@@ -296,6 +340,9 @@ void fetch_qword_copy(uint32_t* hidword, uint32_t* lowdword, int32_t ssss, int32
 void render_spans_1cycle_complete(int start, int end, int tilenum, int flip);
 void render_spans_1cycle_notexel1(int start, int end, int tilenum, int flip);
 void render_spans_1cycle_notex(int start, int end, int tilenum, int flip);
+void render_spans_1cycle_complete_opaque(int start, int end, int tilenum, int flip);
+void render_spans_1cycle_notexel1_opaque(int start, int end, int tilenum, int flip);
+void render_spans_1cycle_notex_opaque(int start, int end, int tilenum, int flip);
 void render_spans_2cycle_complete(int start, int end, int tilenum, int flip);
 void render_spans_2cycle_notexelnext(int start, int end, int tilenum, int flip);
 void render_spans_2cycle_notexel1(int start, int end, int tilenum, int flip);
@@ -304,18 +351,25 @@ void render_spans_fill(int start, int end, int flip);
 void render_spans_copy(int start, int end, int tilenum, int flip);
 static void combiner_1cycle(int adseed, uint32_t* curpixel_cvg);
 static void combiner_2cycle(int adseed, uint32_t* curpixel_cvg);
-static int blender_1cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit);
-static int blender_2cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit);
+static int blender_1cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit);
+static int blender_1cycle_opaque(uint32_t* fr, uint32_t* fg, uint32_t* fb, uint32_t curpixel_cvbit);
+static int blender_2cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit);
 static void texture_pipeline_cycle(COLOR* TEX, COLOR* prev, int32_t SSS, int32_t SST, uint32_t tilenum, uint32_t cycle);
+static void texture_filter(COLOR* TEX, const COLOR* prev, const COLOR* t0, const COLOR* t1, const COLOR* t2, const COLOR* t3, int32_t sfrac, int32_t tfrac, int convert, int midtexel);
+static void texture_convert(COLOR* TEX, const COLOR* t0);
 static void tc_pipeline_copy(int32_t* sss0, int32_t* sss1, int32_t* sss2, int32_t* sss3, int32_t* sst, int tilenum);
 static void tc_pipeline_load(int32_t* sss, int32_t* sst, int tilenum, int coord_quad);
+static void tc_pipeline_cycle(int32_t* sss1, int32_t* sss2, int32_t* sst1, int32_t* sst2, int32_t* sfrac, int32_t* tfrac, int32_t SSS, int32_t SST, uint32_t tilenum);
+#ifndef USE_SSE
 static void tcclamp_cycle(int32_t* S, int32_t* T, int32_t* SFRAC, int32_t* TFRAC, int32_t maxs, int32_t maxt, int32_t num);
-static void tcclamp_cycle_light(int32_t* S, int32_t* T, int32_t maxs, int32_t maxt, int32_t num);
 static void tcshift_cycle(int32_t* S, int32_t* T, int32_t* maxs, int32_t* maxt, uint32_t num);
+#endif
 static void tcshift_copy(int32_t* S, int32_t* T, uint32_t num);
 static int alpha_compare(int32_t comb_alpha);
+#ifndef USE_SSE
 static int32_t color_combiner_equation(int32_t a, int32_t b, int32_t c, int32_t d);
 static int32_t alpha_combiner_equation(int32_t a, int32_t b, int32_t c, int32_t d);
+#endif
 static void blender_equation_cycle0(int* r, int* g, int* b);
 static void blender_equation_cycle0_2(int* r, int* g, int* b);
 static void blender_equation_cycle1(int* r, int* g, int* b);
@@ -323,15 +377,39 @@ static uint32_t rightcvghex(uint32_t x, uint32_t fmask);
 static uint32_t leftcvghex(uint32_t x, uint32_t fmask);
 static void compute_cvg_noflip(int32_t scanline);
 static void compute_cvg_flip(int32_t scanline);
-static void fbfill_4(uint32_t curpixel);
-static void fbfill_8(uint32_t curpixel);
-static void fbfill_16(uint32_t curpixel);
-static void fbfill_32(uint32_t curpixel);
+static void compute_cvg_row(int32_t scanline, int32_t start, int32_t length, int32_t* lo, int32_t* hi, uint32_t* vlo, uint32_t* vhi, uint32_t* vin);
+static void compute_cvg_segment(int32_t x, int32_t end, const int32_t* lo, const int32_t* hi, const uint32_t* vlo, const uint32_t* vhi, const uint32_t* vin);
+static void fbfill_bytes(uint32_t start, uint32_t end);
 static uint32_t z_decompress(uint32_t rawz);
 static uint32_t dz_decompress(uint32_t compresseddz);
 static uint32_t dz_compress(uint32_t value);
 static void lookup_cvmask_derivatives(uint32_t mask, uint8_t* offx, uint8_t* offy, uint32_t* curpixel_cvg, uint32_t* curpixel_cvbit);
+static forceinline void lookup_span_cvg(int x, uint8_t* offx, uint8_t* offy, uint32_t* curpixel_cvg, uint32_t* curpixel_cvbit);
 static void z_store(uint32_t zcurpixel, uint32_t z, int dzpixenc);
+static uint32_t z_test_run(int32_t* runsz, uint32_t zcurpixel, int x, int32_t xinc, int z, int32_t dzinc, uint16_t dzpix);
+static void z_store_run(uint32_t zcurpixel, int32_t xinc, const int32_t* runsz, int dzpixenc, uint32_t mask);
+static int z_run_line_ok(int curpixel, int length, int32_t xinc);
+static void pixq_begin_line(int curpixel, int length, int32_t xinc);
+static forceinline void pixq_push(uint32_t curpixel, uint32_t r, uint32_t g, uint32_t b, int dith, uint32_t blend_en, uint32_t curpixel_cvg, uint32_t curpixel_memcvg);
+static void pixq_flush(void);
+static void fbrow_begin_line(int curpixel, int length, int32_t xinc, int zhidden);
+static void fbrow_prefetch(uint32_t lo, int count);
+static void dither_run(uint32_t mask);
+static forceinline void zbuf_read(uint32_t zcurpixel, uint32_t* zval, uint32_t* hval);
+static forceinline void zbuf_write(uint32_t zcurpixel, uint32_t zval, uint32_t hval);
+static void zmirror_load(uint32_t b);
+static void zmirror_writeback(void);
+static void zmirror_drop(void);
+static void zmirror_release(void);
+static void zmirror_invalidate_range(uint32_t address, uint32_t length);
+static void zmirror_begin_primitive(int start, int end);
+static DIRTYRECT* dirty_lookup(uint32_t address, int create);
+static void dirty_mark_primitive(int start, int end);
+static void dirty_lose_range(uint32_t lo, uint32_t hi, const DIRTYRECT* except);
+static void hiz_invalidate(void);
+static void hiz_store(uint32_t zcurpixel, uint32_t zval, uint32_t hval);
+static void hiz_begin_primitive(int start, int end);
+static int hiz_line_rejected(int y, int x, int32_t xinc, int length, int z, int32_t dzinc, uint16_t dzpix);
 static uint32_t z_compare(uint32_t zcurpixel, uint32_t sz, uint16_t dzpix, int dzpixenc, uint32_t* blend_en, uint32_t* prewrap, uint32_t* curpixel_cvg, uint32_t curpixel_memcvg);
 static int32_t normalize_dzpix(int32_t sum);
 static int32_t CLIP(int32_t value,int32_t min,int32_t max);
@@ -349,38 +427,37 @@ static void get_texel1_1cycle(int32_t* s1, int32_t* t1, int32_t s, int32_t t, in
 static void get_nexttexel0_2cycle(int32_t* s1, int32_t* t1, int32_t s, int32_t t, int32_t w, int32_t dsinc, int32_t dtinc, int32_t dwinc);
 static void calculate_clamp_diffs(uint32_t tile);
 static void calculate_tile_derivs(uint32_t tile);
+static void calculate_tile_sampler(uint32_t tile);
+static forceinline int z_correct_clip(int offx, int offy, int sz, uint32_t curpixel_cvg);
 static void rgbaz_correct_clip(int offx, int offy, int r, int g, int b, int a, int* z, uint32_t curpixel_cvg);
 void deduce_derivatives(void);
 
 static int32_t k0 = 0, k1 = 0, k2 = 0, k3 = 0, k4 = 0, k5 = 0;
+#ifdef USE_SSE
+static int16_t convert_kvec[8] align(16) = {0, 1, 1, 1, 1, 0, 0, 0};
+#endif
 static int32_t lod_frac = 0;
 uint32_t DebugMode = 0, DebugMode2 = 0;
 int debugcolor = 0;
 
-static void (*fbfill_func[4])(uint32_t) =
-{
-  fbfill_4, fbfill_8, fbfill_16, fbfill_32
-};
-
 static void (*tcdiv_func[2])(int32_t, int32_t, int32_t, int32_t*, int32_t*) =
 {
   tcdiv_nopersp, tcdiv_persp
 };
 
-static void (*render_spans_1cycle_func[3])(int, int, int, int) =
+const SpanFuncTable SpanFuncs_base =
 {
-  render_spans_1cycle_notex, render_spans_1cycle_notexel1, render_spans_1cycle_complete
+  {render_spans_1cycle_notex, render_spans_1cycle_notexel1, render_spans_1cycle_complete},
+  {render_spans_1cycle_notex_opaque, render_spans_1cycle_notexel1_opaque, render_spans_1cycle_complete_opaque},
+  {render_spans_2cycle_notex, render_spans_2cycle_notexel1, render_spans_2cycle_notexelnext, render_spans_2cycle_complete}
 };
 
-static void (*render_spans_2cycle_func[4])(int, int, int, int) =
-{
-  render_spans_2cycle_notex, render_spans_2cycle_notexel1, render_spans_2cycle_notexelnext, render_spans_2cycle_complete
-};
+const SpanFuncTable *span_funcs = &SpanFuncs_base;
 
 void (*fbread1_ptr)(uint32_t, uint32_t*);
 void (*fbread2_ptr)(uint32_t, uint32_t*);
 void (*fbwrite_ptr)(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
-void (*fbfill_ptr)(uint32_t) = fbfill_4;
+void (*fbwrite_run_ptr)(uint32_t, uint32_t, const FBRUN*);
 void (*get_dither_noise_ptr)(int, int, int*, int*);
 static DitherFunc rgb_dither_ptr;
 void (*tcdiv_ptr)(int32_t, int32_t, int32_t, int32_t*, int32_t*) = tcdiv_nopersp;
@@ -402,6 +479,112 @@ void RDPSetRDRAMPointer(uint8_t *rdram_ptr) {
   rdram = (uint32_t *) rdram_ptr;
   rdram_8 = (uint8_t*)rdram;
   rdram_16 = (uint16_t*)rdram;
+  hiz_invalidate();
+  zmirror_drop();
+}
+
+/* Must be called whenever anything but the RDP writes RDRAM. */
+void RDPInvalidateRDRAM(uint32_t address, uint32_t length) {
+  uint32_t zlo = hiz_base << 1;
+  uint32_t zhi = zlo + ((hiz_width * (HIZ_ROWS << HIZ_SHIFT)) << 1);
+
+  if (address < zhi && zlo < address + length)
+    hiz_invalidate();
+  zmirror_invalidate_range(address, length);
+  dirty_lose_range(address, address + length, NULL);
+}
+
+/* Enables or disables coarse Z (off by default). The block bounds are only
+   refreshed from RDRAM after RDPInvalidateRDRAM, so while it is on the host
+   must report every write it makes to the Z image, or span lines that
+   should be drawn may be rejected. */
+void RDPSetCoarseZ(int enable) {
+  hiz_invalidate();
+  hiz_enabled = enable;
+}
+
+/* Enables or disables the interleaved Z mirror (off by default). While it
+   is on, the host must call RDPFlushRDRAM before reading RDRAM the RDP may
+   have written, unless a SYNC_FULL came in between. */
+void RDPSetZMirror(int enable) {
+  zmirror_release();
+  zmirror_enabled = enable;
+  zmirror_span = 0;
+}
+
+/* Writes everything the RDP has rendered back to RDRAM. */
+void RDPFlushRDRAM(void) {
+  zmirror_writeback();
+}
+
+/* Converts rows [first, first + count) of a width-pixel image of fb_size
+   at RDRAM address to host 32-bit pixels in the given EXPORT_* layout.
+   Row y lands at dst + y * dst_stride, so a frame can be exported in
+   pieces while the rest of it is still being drawn. Returns -1 for 4-bit
+   images or rows past the end of RDRAM, 0 otherwise. */
+int RDPExportFramebufferRows(uint32_t address, uint32_t width, uint32_t first,
+  uint32_t count, uint32_t fb_size, uint8_t *dst, uint32_t dst_stride, int layout) {
+  uint32_t pitch = PIXELS_TO_BYTES(width, fb_size & 3);
+  uint32_t y;
+
+  if (!FBExportFuncLUT[fb_size & 3] || first + count < first ||
+    (uint64_t) pitch * ((uint64_t) first + count) + address > 0x800000)
+    return -1;
+
+  zmirror_writeback();
+  for (y = first; y < first + count; y++)
+    FBExportFuncLUT[fb_size & 3](address + y * pitch, width, dst + (size_t) y * dst_stride, layout);
+  return 0;
+}
+
+int RDPExportFramebuffer(uint32_t address, uint32_t width, uint32_t height,
+  uint32_t fb_size, uint8_t *dst, uint32_t dst_stride, int layout) {
+  return RDPExportFramebufferRows(address, width, 0, height, fb_size, dst, dst_stride, layout);
+}
+
+/* Reports the box [*x0, *x1) x [*y0, *y1), in pixels, holding everything
+   drawn to the colour image at address since the last call with clear
+   set. Returns 1 if the box is non-empty and 0 if nothing was drawn. -1
+   means the box cannot be trusted, and the caller should assume all of the
+   image changed. That happens when:
+   - the image was not tracked: never drawn to, or pushed out by
+     DIRTY_IMAGES more recent ones;
+   - it was redrawn with another width or pixel size;
+   - a primitive reached lines below any drawn to it before;
+   - something else wrote to it. That means host writes reported through
+     RDPInvalidateRDRAM, or RDP colour or Z writes through an image at
+     another address that overlaps it. */
+int RDPGetDirtyRect(uint32_t address, int clear,
+  uint32_t *x0, uint32_t *y0, uint32_t *x1, uint32_t *y1) {
+  DIRTYRECT *d = dirty_lookup(address & 0x0ffffff, 0);
+  int ret;
+
+  if (!d || d->lost) {
+    ret = -1;
+    *x0 = *y0 = *x1 = *y1 = 0;
+  }
+
+  else {
+    ret = d->x0 < d->x1;
+    *x0 = ret ? d->x0 : 0;
+    *y0 = ret ? d->y0 : 0;
+    *x1 = ret ? d->x1 : 0;
+    *y1 = ret ? d->y1 : 0;
+  }
+
+  if (d && clear) {
+    d->x0 = d->y0 = d->x1 = d->y1 = 0;
+    d->lost = 0;
+  }
+
+  return ret;
+}
+
+/* Selects the dither noise source, NOISE_SERIAL (the default) or
+   NOISE_HASHED. Meant to be called once, before rendering starts. */
+void RDPSetNoiseSource(int source) {
+  noise_source = source;
+  other_modes.f.stalederivs = 1;
 }
 
 void RDPSetRSPDMEMPointer(uint8_t *rsp_dmem_ptr) {
@@ -444,37 +627,7 @@ int32_t min_level = 0;
 int32_t* PreScale;
 uint32_t tvfadeoutstate[625];
 
-static void tcmask(int32_t* S, int32_t* T, int32_t num);
-static void tcmask(int32_t* S, int32_t* T, int32_t num)
-{
-  int32_t wrap;
-  
-  
-
-  if (tile[num].mask_s)
-  {
-    if (tile[num].ms)
-    {
-      wrap = *S >> tile[num].f.masksclamped;
-      wrap &= 1;
-      *S ^= (-wrap);
-    }
-    *S &= maskbits_table[tile[num].mask_s];
-  }
-
-  if (tile[num].mask_t)
-  {
-    if (tile[num].mt)
-    {
-      wrap = *T >> tile[num].f.masktclamped;
-      wrap &= 1;
-      *T ^= (-wrap);
-    }
-    
-    *T &= maskbits_table[tile[num].mask_t];
-  }
-}
-
+#ifndef USE_SSE
 static void tcmask_coupled(int32_t* S, int32_t* S1, int32_t* T, int32_t* T1, int32_t num);
 static void tcmask_coupled(int32_t* S, int32_t* S1, int32_t* T, int32_t* T1, int32_t num)
 {
@@ -517,6 +670,7 @@ static void tcmask_coupled(int32_t* S, int32_t* S1, int32_t* T, int32_t* T1, int
     *T1 &= maskbits;
   }
 }
+#endif
 
 static void tcmask_copy(int32_t* S, int32_t* S1, int32_t* S2, int32_t* S3, int32_t* T, int32_t num);
 static void tcmask_copy(int32_t* S, int32_t* S1, int32_t* S2, int32_t* S3, int32_t* T, int32_t num)
@@ -564,6 +718,7 @@ static void tcmask_copy(int32_t* S, int32_t* S1, int32_t* S2, int32_t* S3, int32
   }
 }
 
+#ifndef USE_SSE
 static void tcshift_cycle(int32_t* S, int32_t* T, int32_t* maxs, int32_t* maxt, uint32_t num)
 {
 
@@ -605,6 +760,7 @@ static void tcshift_cycle(int32_t* S, int32_t* T, int32_t* maxs, int32_t* maxt,
   *T = coord; 
   *maxt = ((coord >> 3) >= tile[num].th);
 } 
+#endif
 
 static void tcshift_copy(int32_t* S, int32_t* T, uint32_t num)
 {
@@ -640,6 +796,7 @@ static void tcshift_copy(int32_t* S, int32_t* T, uint32_t num)
   
 }
 
+#ifndef USE_SSE
 static void tcclamp_cycle(int32_t* S, int32_t* T, int32_t* SFRAC, int32_t* TFRAC, int32_t maxs, int32_t maxt, int32_t num)
 {
 
@@ -686,48 +843,17 @@ static void tcclamp_cycle(int32_t* S, int32_t* T, int32_t* SFRAC, int32_t* TFRAC
   else
     *T = (loct >> 5);
 }
-
-static void tcclamp_cycle_light(int32_t* S, int32_t* T, int32_t maxs, int32_t maxt, int32_t num)
-{
-  int32_t locs = *S, loct = *T;
-  if (tile[num].f.clampens)
-  {
-    if (!(locs & 0x10000))
-    {
-      if (!maxs)
-        *S = (locs >> 5);
-      else
-        *S = tile[num].f.clampdiffs;
-    }
-    else
-      *S = 0;
-  }
-  else
-    *S = (locs >> 5);
-
-  if (tile[num].f.clampent)
-  {
-    if (!(loct & 0x10000))
-    {
-      if (!maxt)
-        *T = (loct >> 5);
-      else
-        *T = tile[num].f.clampdifft;
-    }
-    else
-      *T = 0;
-  }
-  else
-    *T = (loct >> 5);
-}
+#endif
 
 int rdp_init()
 {
   rgb_dither_ptr = DitherFuncLUT[0];
-  get_dither_noise_ptr = DitherNoiseFuncLUT[0];
+  get_dither_noise_ptr = (noise_source == NOISE_HASHED) ?
+    DitherNoiseHashedFuncLUT[0] : DitherNoiseFuncLUT[0];
   fbread1_ptr = FBReadFuncLUT[0];
   fbread2_ptr = FBReadFunc2LUT[0];
   fbwrite_ptr = FBWriteFuncLUT[0];
+  fbwrite_run_ptr = FBWriteRunFuncLUT[0];
 
   combiner_rgbsub_a_r[0] = combiner_rgbsub_a_r[1] = &one_color;
   combiner_rgbsub_a_g[0] = combiner_rgbsub_a_g[1] = &one_color;
@@ -937,12 +1063,115 @@ static void SET_MUL_ALPHA_INPUT(int32_t **input, int code) {
   *input = alpha_inputs[code];
 }
 
+#ifdef USE_SSE
+/*
+ * special_9bit_exttable: 0x000-0x17f stay positive, 0x180-0x1ff wrap.
+ */
+static __m128i combiner_ext9(__m128i x)
+{
+  __m128i bias = _mm_set1_epi32(0x80);
+
+  x = _mm_and_si128(_mm_add_epi32(x, bias), _mm_set1_epi32(0x1ff));
+  return _mm_sub_epi32(x, bias);
+}
+
+/*
+ * special_9bit_clamptable: extend, then saturate to 0-255.
+ */
+static __m128i combiner_clamp9(__m128i x)
+{
+  __m128i zero = _mm_setzero_si128();
+
+  x = combiner_ext9(x);
+  x = _mm_packs_epi32(x, x);
+  x = _mm_packus_epi16(x, x);
+  x = _mm_unpacklo_epi8(x, zero);
+  return _mm_unpacklo_epi16(x, zero);
+}
+
+/*
+ * Evaluates (A - B) * C + D for R, G, B and A of one combiner cycle. Each
+ * lane packs (A - B, D) and (C, 0x100) as 16-bit pairs so a single pmaddwd
+ * forms the product and the shifted addend. RGB lanes come back as 17-bit
+ * values, the alpha lane as the 9-bit result of alpha_combiner_equation.
+ */
+static __m128i combiner_equation_vector(int cycle, __m128i* suba)
+{
+  __m128i a, b, c, d, sum;
+  __m128i rgbmask = _mm_setr_epi32(~0, ~0, ~0, 0);
+
+  a = _mm_setr_epi32(*combiner_rgbsub_a_r[cycle], *combiner_rgbsub_a_g[cycle],
+    *combiner_rgbsub_a_b[cycle], *combiner_alphasub_a[cycle]);
+  b = _mm_setr_epi32(*combiner_rgbsub_b_r[cycle], *combiner_rgbsub_b_g[cycle],
+    *combiner_rgbsub_b_b[cycle], *combiner_alphasub_b[cycle]);
+  c = _mm_setr_epi32(*combiner_rgbmul_r[cycle], *combiner_rgbmul_g[cycle],
+    *combiner_rgbmul_b[cycle], *combiner_alphamul[cycle]);
+  d = _mm_setr_epi32(*combiner_rgbadd_r[cycle], *combiner_rgbadd_g[cycle],
+    *combiner_rgbadd_b[cycle], *combiner_alphaadd[cycle]);
+  *suba = a;
+
+  a = _mm_sub_epi32(combiner_ext9(a), combiner_ext9(b));
+  a = _mm_and_si128(a, _mm_set1_epi32(0xffff));
+  a = _mm_or_si128(a, _mm_slli_epi32(combiner_ext9(d), 16));
+  c = _mm_srai_epi32(_mm_slli_epi32(c, 23), 23);
+  c = _mm_and_si128(c, _mm_set1_epi32(0xffff));
+  c = _mm_or_si128(c, _mm_set1_epi32(0x100 << 16));
+  sum = _mm_add_epi32(_mm_madd_epi16(a, c), _mm_set1_epi32(0x80));
+
+  return _mm_or_si128(
+    _mm_and_si128(_mm_and_si128(sum, _mm_set1_epi32(0x1ffff)), rgbmask),
+    _mm_andnot_si128(rgbmask, _mm_and_si128(_mm_srai_epi32(sum, 8), _mm_set1_epi32(0x1ff))));
+}
+
+/*
+ * Final combiner cycle: produces combined_color, pixel_color (RGB and the
+ * clamped alpha) and, in key mode, keyalpha.
+ */
+static void combiner_rgba_cycle(int cycle)
+{
+  __m128i rgbmask = _mm_setr_epi32(~0, ~0, ~0, 0);
+  __m128i suba, comb, shifted, pixel;
+
+  comb = combiner_equation_vector(cycle, &suba);
+  shifted = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(comb, 8), rgbmask),
+    _mm_andnot_si128(rgbmask, comb));
+
+  if (!other_modes.key_en)
+    pixel = combiner_clamp9(shifted);
+  else
+  {
+    int32_t keys[4] align(16);
+    __m128i key;
+
+    key = _mm_srai_epi32(_mm_slli_epi32(comb, 15), 15);
+    key = _mm_sub_epi32(_mm_slli_epi32(_mm_loadu_si128((__m128i*) &key_width), 4),
+      _mm_abs_epi32(key));
+    _mm_store_si128((__m128i*) keys, key);
+
+    keyalpha = (keys[0] < keys[1]) ? keys[0] : keys[1];
+    keyalpha = (keys[2] < keyalpha) ? keys[2] : keyalpha;
+    keyalpha = CLIP(keyalpha, 0, 0xff);
+
+    pixel = combiner_clamp9(_mm_or_si128(_mm_and_si128(suba, rgbmask),
+      _mm_andnot_si128(rgbmask, comb)));
+  }
+
+  _mm_storeu_si128((__m128i*) &combined_color, shifted);
+  _mm_storeu_si128((__m128i*) &pixel_color, pixel);
+
+  if (pixel_color.a == 0xff)
+    pixel_color.a = 0x100;
+}
+#endif
+
 static void combiner_1cycle(int adseed, uint32_t* curpixel_cvg)
 {
+  int32_t temp;
 
-  int32_t redkey, greenkey, bluekey, temp;
-
-  
+#ifdef USE_SSE
+  combiner_rgba_cycle(1);
+#else
+  int32_t redkey, greenkey, bluekey;
 
   
   combined_color.r = color_combiner_equation(*combiner_rgbsub_a_r[1],*combiner_rgbsub_b_r[1],*combiner_rgbmul_r[1],*combiner_rgbadd_r[1]);
@@ -995,8 +1224,8 @@ static void combiner_1cycle(int adseed, uint32_t* curpixel_cvg)
     combined_color.g >>= 8;
     combined_color.b >>= 8;
   }
-  
-  
+#endif
+
   if (other_modes.cvg_times_alpha)
   {
     temp = (pixel_color.a * (*curpixel_cvg) + 4) >> 3;
@@ -1032,7 +1261,23 @@ static void combiner_1cycle(int adseed, uint32_t* curpixel_cvg)
 
 static void combiner_2cycle(int adseed, uint32_t* curpixel_cvg)
 {
-  int32_t redkey, greenkey, bluekey, temp;
+  int32_t temp;
+
+#ifdef USE_SSE
+  __m128i suba, comb;
+
+  comb = combiner_equation_vector(0, &suba);
+  comb = _mm_or_si128(
+    _mm_and_si128(_mm_srli_epi32(comb, 8), _mm_setr_epi32(~0, ~0, ~0, 0)),
+    _mm_and_si128(comb, _mm_setr_epi32(0, 0, 0, ~0)));
+  _mm_storeu_si128((__m128i*) &combined_color, comb);
+
+  texel0_color = texel1_color;
+  texel1_color = nexttexel_color;
+
+  combiner_rgba_cycle(1);
+#else
+  int32_t redkey, greenkey, bluekey;
 
   combined_color.r = color_combiner_equation(*combiner_rgbsub_a_r[0],*combiner_rgbsub_b_r[0],*combiner_rgbmul_r[0],*combiner_rgbadd_r[0]);
   combined_color.g = color_combiner_equation(*combiner_rgbsub_a_g[0],*combiner_rgbsub_b_g[0],*combiner_rgbmul_g[0],*combiner_rgbadd_g[0]);
@@ -1110,8 +1355,8 @@ static void combiner_2cycle(int adseed, uint32_t* curpixel_cvg)
   pixel_color.a = special_9bit_clamptable[combined_color.a];
   if (pixel_color.a == 0xff)
     pixel_color.a = 0x100;
+#endif
 
-  
   if (other_modes.cvg_times_alpha)
   {
     temp = (pixel_color.a * (*curpixel_cvg) + 4) >> 3;
@@ -1210,7 +1455,7 @@ static void SET_BLENDER_INPUT(int cycle, int which, int32_t **input_r, int32_t *
   }
 }
 
-static int blender_1cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit)
+static int blender_1cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit)
 {
   int r, g, b, dontblend;
   
@@ -1253,7 +1498,6 @@ static int blender_1cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, ui
         b = *blender2a_b[0];
       }
 
-      rgb_dither_ptr(&r, &g, &b, dith);
       *fr = r;
       *fg = g;
       *fb = b;
@@ -1266,7 +1510,26 @@ static int blender_1cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, ui
     return 0;
 }
 
-static int blender_2cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit)
+static int blender_1cycle_opaque(uint32_t* fr, uint32_t* fg, uint32_t* fb, uint32_t curpixel_cvbit)
+{
+  int r, g, b;
+
+  if (alpha_compare(pixel_color.a) && curpixel_cvbit)
+  {
+    r = pixel_color.r;
+    g = pixel_color.g;
+    b = pixel_color.b;
+
+    *fr = r;
+    *fg = g;
+    *fb = b;
+    return 1;
+  }
+
+  return 0;
+}
+
+static int blender_2cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit)
 {
   int r, g, b, dontblend;
 
@@ -1311,7 +1574,6 @@ static int blender_2cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, ui
       }
 
       
-      rgb_dither_ptr(&r, &g, &b, dith);
       *fr = r;
       *fg = g;
       *fb = b;
@@ -1324,7 +1586,7 @@ static int blender_2cycle(uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, ui
     return 0;
 }
 
-static void fetch_texel(COLOR *color, int s, int t, uint32_t tilenum)
+static forceinline void fetch_texel_generic(COLOR *color, int s, int t, uint32_t tilenum, uint32_t sw)
 {
   uint32_t tbase = tile[tilenum].line * t + tile[tilenum].tmem;
   
@@ -1345,7 +1607,7 @@ static void fetch_texel(COLOR *color, int s, int t, uint32_t tilenum)
 
   
 
-  switch (tile[tilenum].f.notlutswitch)
+  switch (sw)
   {
   case TEXEL_RGBA4:
     {
@@ -1656,7 +1918,7 @@ static void fetch_texel(COLOR *color, int s, int t, uint32_t tilenum)
   }
 }
 
-static void fetch_texel_entlut(COLOR *color, int s, int t, uint32_t tilenum)
+static forceinline void fetch_texel_entlut_generic(COLOR *color, int s, int t, uint32_t tilenum, uint32_t sw)
 {
   uint32_t tbase = tile[tilenum].line * t + tile[tilenum].tmem;
   uint32_t tpal = tile[tilenum].palette << 4;
@@ -1666,7 +1928,7 @@ static void fetch_texel_entlut(COLOR *color, int s, int t, uint32_t tilenum)
 
   
   
-  switch(tile[tilenum].f.tlutswitch)
+  switch (sw)
   {
   case 0:
   case 1:
@@ -1756,7 +2018,7 @@ static void fetch_texel_entlut(COLOR *color, int s, int t, uint32_t tilenum)
 
 }
 
-static void fetch_texel_quadro(COLOR *color0, COLOR *color1, COLOR *color2, COLOR *color3, int s0, int s1, int t0, int t1, uint32_t tilenum)
+static forceinline void fetch_texel_quadro_generic(COLOR *color0, COLOR *color1, COLOR *color2, COLOR *color3, int s0, int s1, int t0, int t1, uint32_t tilenum, uint32_t sw)
 {
 
   uint32_t tbase0 = tile[tilenum].line * t0 + tile[tilenum].tmem;
@@ -1771,7 +2033,7 @@ static void fetch_texel_quadro(COLOR *color0, COLOR *color1, COLOR *color2, COLO
   uint32_t taddr0 = 0, taddr1 = 0, taddr2 = 0, taddr3 = 0;
   uint32_t taddrlow0 = 0, taddrlow1 = 0, taddrlow2 = 0, taddrlow3 = 0;
 
-  switch (tile[tilenum].f.notlutswitch)
+  switch (sw)
   {
   case TEXEL_RGBA4:
     {
@@ -2632,7 +2894,7 @@ static void fetch_texel_quadro(COLOR *color0, COLOR *color1, COLOR *color2, COLO
   }
 }
 
-static void fetch_texel_entlut_quadro(COLOR *color0, COLOR *color1, COLOR *color2, COLOR *color3, int s0, int s1, int t0, int t1, uint32_t tilenum)
+static forceinline void fetch_texel_entlut_quadro_generic(COLOR *color0, COLOR *color1, COLOR *color2, COLOR *color3, int s0, int s1, int t0, int t1, uint32_t tilenum, uint32_t sw)
 {
   uint32_t tbase0 = tile[tilenum].line * t0 + tile[tilenum].tmem;
   uint32_t tbase2 = tile[tilenum].line * t1 + tile[tilenum].tmem;
@@ -2645,7 +2907,7 @@ static void fetch_texel_entlut_quadro(COLOR *color0, COLOR *color1, COLOR *color
 
   
   
-  switch(tile[tilenum].f.tlutswitch)
+  switch (sw)
   {
   case 0:
   case 1:
@@ -2868,6 +3130,112 @@ static void fetch_texel_entlut_quadro(COLOR *color0, COLOR *color1, COLOR *color
   }
 }
 
+/*
+ * Every texel format gets its own copy of the fetchers, with the format
+ * switch resolved at compile time. calculate_tile_sampler picks the pair
+ * matching a tile whenever the tile or the TLUT mode changes, so the span
+ * loops call straight into the right one.
+ */
+#define FETCH_TEXEL_VARIANT(name, sw) \
+  static void fetch_texel_##name(COLOR *color, int s, int t, uint32_t tilenum) \
+  { \
+    fetch_texel_generic(color, s, t, tilenum, sw); \
+  } \
+  static void fetch_texel_quadro_##name(COLOR *color0, COLOR *color1, \
+    COLOR *color2, COLOR *color3, int s0, int s1, int t0, int t1, uint32_t tilenum) \
+  { \
+    fetch_texel_quadro_generic(color0, color1, color2, color3, \
+      s0, s1, t0, t1, tilenum, sw); \
+  }
+
+#define FETCH_TEXEL_ENTLUT_VARIANT(name, sw) \
+  static void fetch_texel_entlut_##name(COLOR *color, int s, int t, uint32_t tilenum) \
+  { \
+    fetch_texel_entlut_generic(color, s, t, tilenum, sw); \
+  } \
+  static void fetch_texel_entlut_quadro_##name(COLOR *color0, COLOR *color1, \
+    COLOR *color2, COLOR *color3, int s0, int s1, int t0, int t1, uint32_t tilenum) \
+  { \
+    fetch_texel_entlut_quadro_generic(color0, color1, color2, color3, \
+      s0, s1, t0, t1, tilenum, sw); \
+  }
+
+FETCH_TEXEL_VARIANT(rgba4, TEXEL_RGBA4)
+FETCH_TEXEL_VARIANT(rgba8, TEXEL_RGBA8)
+FETCH_TEXEL_VARIANT(rgba16, TEXEL_RGBA16)
+FETCH_TEXEL_VARIANT(rgba32, TEXEL_RGBA32)
+FETCH_TEXEL_VARIANT(yuv4, TEXEL_YUV4)
+FETCH_TEXEL_VARIANT(yuv16, TEXEL_YUV16)
+FETCH_TEXEL_VARIANT(ci4, TEXEL_CI4)
+FETCH_TEXEL_VARIANT(ci8, TEXEL_CI8)
+FETCH_TEXEL_VARIANT(ci16, TEXEL_CI16)
+FETCH_TEXEL_VARIANT(ci32, TEXEL_CI32)
+FETCH_TEXEL_VARIANT(ia4, TEXEL_IA4)
+FETCH_TEXEL_VARIANT(ia8, TEXEL_IA8)
+FETCH_TEXEL_VARIANT(ia16, TEXEL_IA16)
+FETCH_TEXEL_VARIANT(ia32, TEXEL_IA32)
+FETCH_TEXEL_VARIANT(i4, TEXEL_I4)
+FETCH_TEXEL_VARIANT(i8, TEXEL_I8)
+FETCH_TEXEL_VARIANT(i16, TEXEL_I16)
+FETCH_TEXEL_VARIANT(i32, TEXEL_I32)
+FETCH_TEXEL_VARIANT(invalid, tile[tilenum].f.notlutswitch)
+
+FETCH_TEXEL_ENTLUT_VARIANT(0, 0)
+FETCH_TEXEL_ENTLUT_VARIANT(3, 3)
+FETCH_TEXEL_ENTLUT_VARIANT(4, 4)
+FETCH_TEXEL_ENTLUT_VARIANT(8, 8)
+FETCH_TEXEL_ENTLUT_VARIANT(11, 11)
+FETCH_TEXEL_ENTLUT_VARIANT(12, 12)
+FETCH_TEXEL_ENTLUT_VARIANT(15, 15)
+
+static const FetchTexelFunc FetchTexelFuncLUT[32] = {
+  fetch_texel_rgba4,    fetch_texel_rgba8,    fetch_texel_rgba16,   fetch_texel_rgba32,
+  fetch_texel_yuv4,     fetch_texel_yuv4,     fetch_texel_yuv16,    fetch_texel_yuv16,
+  fetch_texel_ci4,      fetch_texel_ci8,      fetch_texel_ci16,     fetch_texel_ci32,
+  fetch_texel_ia4,      fetch_texel_ia8,      fetch_texel_ia16,     fetch_texel_ia32,
+  fetch_texel_i4,       fetch_texel_i8,       fetch_texel_i16,      fetch_texel_i32,
+  fetch_texel_invalid,  fetch_texel_invalid,  fetch_texel_invalid,  fetch_texel_invalid,
+  fetch_texel_invalid,  fetch_texel_invalid,  fetch_texel_invalid,  fetch_texel_invalid,
+  fetch_texel_invalid,  fetch_texel_invalid,  fetch_texel_invalid,  fetch_texel_invalid,
+};
+
+static const FetchTexelQuadroFunc FetchTexelQuadroFuncLUT[32] = {
+  fetch_texel_quadro_rgba4,   fetch_texel_quadro_rgba8,
+  fetch_texel_quadro_rgba16,  fetch_texel_quadro_rgba32,
+  fetch_texel_quadro_yuv4,    fetch_texel_quadro_yuv4,
+  fetch_texel_quadro_yuv16,   fetch_texel_quadro_yuv16,
+  fetch_texel_quadro_ci4,     fetch_texel_quadro_ci8,
+  fetch_texel_quadro_ci16,    fetch_texel_quadro_ci32,
+  fetch_texel_quadro_ia4,     fetch_texel_quadro_ia8,
+  fetch_texel_quadro_ia16,    fetch_texel_quadro_ia32,
+  fetch_texel_quadro_i4,      fetch_texel_quadro_i8,
+  fetch_texel_quadro_i16,     fetch_texel_quadro_i32,
+  fetch_texel_quadro_invalid, fetch_texel_quadro_invalid,
+  fetch_texel_quadro_invalid, fetch_texel_quadro_invalid,
+  fetch_texel_quadro_invalid, fetch_texel_quadro_invalid,
+  fetch_texel_quadro_invalid, fetch_texel_quadro_invalid,
+  fetch_texel_quadro_invalid, fetch_texel_quadro_invalid,
+  fetch_texel_quadro_invalid, fetch_texel_quadro_invalid,
+};
+
+static const FetchTexelFunc FetchTexelEntlutFuncLUT[16] = {
+  fetch_texel_entlut_0,   fetch_texel_entlut_0,   fetch_texel_entlut_0,   fetch_texel_entlut_3,
+  fetch_texel_entlut_4,   fetch_texel_entlut_4,   fetch_texel_entlut_4,   fetch_texel_entlut_4,
+  fetch_texel_entlut_8,   fetch_texel_entlut_8,   fetch_texel_entlut_8,   fetch_texel_entlut_11,
+  fetch_texel_entlut_12,  fetch_texel_entlut_12,  fetch_texel_entlut_12,  fetch_texel_entlut_15,
+};
+
+static const FetchTexelQuadroFunc FetchTexelEntlutQuadroFuncLUT[16] = {
+  fetch_texel_entlut_quadro_0,  fetch_texel_entlut_quadro_0,
+  fetch_texel_entlut_quadro_0,  fetch_texel_entlut_quadro_3,
+  fetch_texel_entlut_quadro_4,  fetch_texel_entlut_quadro_4,
+  fetch_texel_entlut_quadro_4,  fetch_texel_entlut_quadro_4,
+  fetch_texel_entlut_quadro_8,  fetch_texel_entlut_quadro_8,
+  fetch_texel_entlut_quadro_8,  fetch_texel_entlut_quadro_11,
+  fetch_texel_entlut_quadro_12, fetch_texel_entlut_quadro_12,
+  fetch_texel_entlut_quadro_12, fetch_texel_entlut_quadro_15,
+};
+
 void get_tmem_idx(int s, int t, uint32_t tilenum, uint32_t* idx0, uint32_t* idx1, uint32_t* idx2, uint32_t* idx3, uint32_t* bit3flipped, uint32_t* hibit)
 {
   uint32_t tbase = (tile[tilenum].line * t) & 0x1ff;
@@ -3219,154 +3587,31 @@ static void texture_pipeline_cycle(COLOR* TEX, COLOR* prev, int32_t SSS, int32_t
 {
 #define TRELATIVE(x, y)   ((x) - ((y) << 3));
 #define UPPER ((sfrac + tfrac) & 0x20)
-  int32_t maxs, maxt, invt0r, invt0g, invt0b, invt0a;
-  int32_t sfrac, tfrac, invsf, invtf;
+  int32_t sfrac, tfrac;
   int bilerp = cycle ? other_modes.bi_lerp1 : other_modes.bi_lerp0;
   int convert = other_modes.convert_one && cycle;
   COLOR t0, t1, t2, t3;
   int sss1, sst1, sss2, sst2;
-  int32_t newk0, newk1, newk2, newk3, invk0, invk1, invk2, invk3;
-
-  sss1 = SSS;
-  sst1 = SST;
 
-  tcshift_cycle(&sss1, &sst1, &maxs, &maxt, tilenum);
-
-  sss1 = TRELATIVE(sss1, tile[tilenum].sl);
-  sst1 = TRELATIVE(sst1, tile[tilenum].tl);
+  tc_pipeline_cycle(&sss1, &sss2, &sst1, &sst2, &sfrac, &tfrac, SSS, SST, tilenum);
 
   if (other_modes.sample_type)
   { 
-    sfrac = sss1 & 0x1f;
-    tfrac = sst1 & 0x1f;
-
-    tcclamp_cycle(&sss1, &sst1, &sfrac, &tfrac, maxs, maxt, tilenum);
-    
-  
-    if (tile[tilenum].format != FORMAT_YUV)
-      sss2 = sss1 + 1;
-    else
-      sss2 = sss1 + 2;
-    
-    
-    
-
-    sst2 = sst1 + 1;
-    
-
-    
-    tcmask_coupled(&sss1, &sss2, &sst1, &sst2, tilenum);
-    
-    
-
-    
-    
-    
-    
-
-    
     if (bilerp)
     {
       
-      if (!other_modes.en_tlut)
-        fetch_texel_quadro(&t0, &t1, &t2, &t3, sss1, sss2, sst1, sst2, tilenum);
-      else
-        fetch_texel_entlut_quadro(&t0, &t1, &t2, &t3, sss1, sss2, sst1, sst2, tilenum);
+      tile[tilenum].f.fetch_texel_quadro(&t0, &t1, &t2, &t3, sss1, sss2, sst1, sst2, tilenum);
 
-      if (!other_modes.mid_texel || sfrac != 0x10 || tfrac != 0x10)
-      {
-        if (!convert)
-        {
-          if (UPPER)
-          {
-            
-            invsf = 0x20 - sfrac;
-            invtf = 0x20 - tfrac;
-            TEX->r = t3.r + ((((invsf * (t2.r - t3.r)) + (invtf * (t1.r - t3.r))) + 0x10) >> 5);  
-            TEX->g = t3.g + ((((invsf * (t2.g - t3.g)) + (invtf * (t1.g - t3.g))) + 0x10) >> 5);                                    
-            TEX->b = t3.b + ((((invsf * (t2.b - t3.b)) + (invtf * (t1.b - t3.b))) + 0x10) >> 5);                                
-            TEX->a = t3.a + ((((invsf * (t2.a - t3.a)) + (invtf * (t1.a - t3.a))) + 0x10) >> 5);
-          }
-          else
-          {
-            TEX->r = t0.r + ((((sfrac * (t1.r - t0.r)) + (tfrac * (t2.r - t0.r))) + 0x10) >> 5);                      
-            TEX->g = t0.g + ((((sfrac * (t1.g - t0.g)) + (tfrac * (t2.g - t0.g))) + 0x10) >> 5);                      
-            TEX->b = t0.b + ((((sfrac * (t1.b - t0.b)) + (tfrac * (t2.b - t0.b))) + 0x10) >> 5);                  
-            TEX->a = t0.a + ((((sfrac * (t1.a - t0.a)) + (tfrac * (t2.a - t0.a))) + 0x10) >> 5);
-          }
-        }
-        else
-        {
-          if (UPPER)
-          {
-            TEX->r = prev->b + ((((prev->r * (t2.r - t3.r)) + (prev->g * (t1.r - t3.r))) + 0x80) >> 8); 
-            TEX->g = prev->b + ((((prev->r * (t2.g - t3.g)) + (prev->g * (t1.g - t3.g))) + 0x80) >> 8);                                   
-            TEX->b = prev->b + ((((prev->r * (t2.b - t3.b)) + (prev->g * (t1.b - t3.b))) + 0x80) >> 8);                               
-            TEX->a = prev->b + ((((prev->r * (t2.a - t3.a)) + (prev->g * (t1.a - t3.a))) + 0x80) >> 8);
-          }
-          else
-          {
-            TEX->r = prev->b + ((((prev->r * (t1.r - t0.r)) + (prev->g * (t2.r - t0.r))) + 0x80) >> 8);                     
-            TEX->g = prev->b + ((((prev->r * (t1.g - t0.g)) + (prev->g * (t2.g - t0.g))) + 0x80) >> 8);                     
-            TEX->b = prev->b + ((((prev->r * (t1.b - t0.b)) + (prev->g * (t2.b - t0.b))) + 0x80) >> 8);                 
-            TEX->a = prev->b + ((((prev->r * (t1.a - t0.a)) + (prev->g * (t2.a - t0.a))) + 0x80) >> 8);
-          } 
-        }
-        
-      }
-      else
-      {
-        invt0r  = ~t0.r; invt0g = ~t0.g; invt0b = ~t0.b; invt0a = ~t0.a;
-        if (!convert)
-        {
-          sfrac <<= 2;
-          tfrac <<= 2;
-          TEX->r = t0.r + ((((sfrac * (t1.r - t0.r)) + (tfrac * (t2.r - t0.r))) + ((invt0r + t3.r) << 6) + 0xc0) >> 8);                     
-          TEX->g = t0.g + ((((sfrac * (t1.g - t0.g)) + (tfrac * (t2.g - t0.g))) + ((invt0g + t3.g) << 6) + 0xc0) >> 8);                     
-          TEX->b = t0.b + ((((sfrac * (t1.b - t0.b)) + (tfrac * (t2.b - t0.b))) + ((invt0b + t3.b) << 6) + 0xc0) >> 8);                 
-          TEX->a = t0.a + ((((sfrac * (t1.a - t0.a)) + (tfrac * (t2.a - t0.a))) + ((invt0a + t3.a) << 6) + 0xc0) >> 8);
-        }
-        else
-        {
-          TEX->r = prev->b + ((((prev->r * (t1.r - t0.r)) + (prev->g * (t2.r - t0.r))) + ((invt0r + t3.r) << 6) + 0xc0) >> 8);                      
-          TEX->g = prev->b + ((((prev->r * (t1.g - t0.g)) + (prev->g * (t2.g - t0.g))) + ((invt0g + t3.g) << 6) + 0xc0) >> 8);                      
-          TEX->b = prev->b + ((((prev->r * (t1.b - t0.b)) + (prev->g * (t2.b - t0.b))) + ((invt0b + t3.b) << 6) + 0xc0) >> 8);                  
-          TEX->a = prev->b + ((((prev->r * (t1.a - t0.a)) + (prev->g * (t2.a - t0.a))) + ((invt0a + t3.a) << 6) + 0xc0) >> 8);
-        }
-      }
-      
+      texture_filter(TEX, prev, &t0, &t1, &t2, &t3, sfrac, tfrac, convert,
+        other_modes.mid_texel && sfrac == 0x10 && tfrac == 0x10);
     }
     else
     {
-      newk0 = SIGN(k0, 9); 
-      newk1 = SIGN(k1, 9); 
-      newk2 = SIGN(k2, 9); 
-      newk3 = SIGN(k3, 9);
-      invk0 = ~newk0; 
-      invk1 = ~newk1; 
-      invk2 = ~newk2; 
-      invk3 = ~newk3;
-      if (!other_modes.en_tlut)
-        fetch_texel(&t0, sss1, sst1, tilenum);
-      else
-        fetch_texel_entlut(&t0, sss1, sst1, tilenum);
+      tile[tilenum].f.fetch_texel(&t0, sss1, sst1, tilenum);
       if (convert)
         t0 = *prev;
-      t0.r = SIGN(t0.r, 9);
-      t0.g = SIGN(t0.g, 9); 
-      t0.b = SIGN(t0.b, 9);
-      TEX->r = t0.b + ((((newk0 - invk0) * t0.g) + 0x80) >> 8);
-      TEX->g = t0.b + ((((newk1 - invk1) * t0.r + (newk2 - invk2) * t0.g) + 0x80) >> 8);
-      TEX->b = t0.b + ((((newk3 - invk3) * t0.r) + 0x80) >> 8);
-      TEX->a = t0.b;
+      texture_convert(TEX, &t0);
     }
-    
-    TEX->r &= 0x1ff;
-    TEX->g &= 0x1ff;
-    TEX->b &= 0x1ff;
-    TEX->a &= 0x1ff;
-    
-    
   }
   else                                                
   {                                                   
@@ -3374,15 +3619,7 @@ static void texture_pipeline_cycle(COLOR* TEX, COLOR* prev, int32_t SSS, int32_t
     
     
 
-    tcclamp_cycle_light(&sss1, &sst1, maxs, maxt, tilenum);
-    
-        tcmask(&sss1, &sst1, tilenum);  
-                                                    
-      
-    if (!other_modes.en_tlut)
-      fetch_texel(&t0, sss1, sst1, tilenum);
-    else
-      fetch_texel_entlut(&t0, sss1, sst1, tilenum);
+    tile[tilenum].f.fetch_texel(&t0, sss1, sst1, tilenum);
     
     if (bilerp)
     {
@@ -3393,63 +3630,277 @@ static void texture_pipeline_cycle(COLOR* TEX, COLOR* prev, int32_t SSS, int32_t
     }
     else
     {
-      newk0 = SIGN(k0, 9); 
-      newk1 = SIGN(k1, 9); 
-      newk2 = SIGN(k2, 9); 
-      newk3 = SIGN(k3, 9);
-      invk0 = ~newk0; 
-      invk1 = ~newk1; 
-      invk2 = ~newk2; 
-      invk3 = ~newk3;
       if (convert)
         t0 = *prev;
-      t0.r = SIGN(t0.r, 9);
-      t0.g = SIGN(t0.g, 9); 
-      t0.b = SIGN(t0.b, 9);
-      TEX->r = t0.b + ((((newk0 - invk0) * t0.g) + 0x80) >> 8);
-      TEX->g = t0.b + ((((newk1 - invk1) * t0.r + (newk2 - invk2) * t0.g) + 0x80) >> 8);
-      TEX->b = t0.b + ((((newk3 - invk3) * t0.r) + 0x80) >> 8);
-      TEX->a = t0.b;
-      TEX->r &= 0x1ff;
-      TEX->g &= 0x1ff;
-      TEX->b &= 0x1ff;
-      TEX->a &= 0x1ff;
+      texture_convert(TEX, &t0);
     }
   }
                                                   
 }
 
-static void tc_pipeline_copy(int32_t* sss0, int32_t* sss1, int32_t* sss2, int32_t* sss3, int32_t* sst, int tilenum)                     
+static void texture_filter(COLOR* TEX, const COLOR* prev, const COLOR* t0, const COLOR* t1, const COLOR* t2, const COLOR* t3, int32_t sfrac, int32_t tfrac, int convert, int midtexel)
 {
-  int ss0 = *sss0, ss1 = 0, ss2 = 0, ss3 = 0, st = *sst;
-
-  tcshift_copy(&ss0, &st, tilenum);
-  
-  
-
-  ss0 = TRELATIVE(ss0, tile[tilenum].sl);
-  st = TRELATIVE(st, tile[tilenum].tl);
-  ss0 = (ss0 >> 5);
-  st = (st >> 5);
+#ifdef USE_SSE
+  __m128i c0 = _mm_loadu_si128((__m128i*) t0);
+  __m128i c1 = _mm_loadu_si128((__m128i*) t1);
+  __m128i c2 = _mm_loadu_si128((__m128i*) t2);
+  __m128i c3 = _mm_loadu_si128((__m128i*) t3);
+  __m128i base, d1, d2, sum;
+  int32_t m1, m2;
+
+  if (!midtexel && UPPER)
+  {
+    base = c3;
+    d1 = _mm_sub_epi32(c2, c3);
+    d2 = _mm_sub_epi32(c1, c3);
+    m1 = 0x20 - sfrac;
+    m2 = 0x20 - tfrac;
+  }
+  else
+  {
+    base = c0;
+    d1 = _mm_sub_epi32(c1, c0);
+    d2 = _mm_sub_epi32(c2, c0);
+    m1 = midtexel ? sfrac << 2 : sfrac;
+    m2 = midtexel ? tfrac << 2 : tfrac;
+  }
 
-  ss1 = ss0 + 1;
-  ss2 = ss0 + 2;
-  ss3 = ss0 + 3;
+  if (convert)
+  {
+    base = _mm_set1_epi32(prev->b);
+    m1 = prev->r;
+    m2 = prev->g;
+  }
 
-  tcmask_copy(&ss0, &ss1, &ss2, &ss3, &st, tilenum);  
+  /* Texels and weights are 9-bit: interleave the two differences of */
+  /* each channel and let pmaddwd form d1 * m1 + d2 * m2 in 32 bits. */
+  d1 = _mm_packs_epi32(d1, d1);
+  d2 = _mm_packs_epi32(d2, d2);
+  sum = _mm_madd_epi16(_mm_unpacklo_epi16(d1, d2),
+    _mm_set1_epi32((m2 << 16) | (m1 & 0xffff)));
 
-  *sss0 = ss0;
-  *sss1 = ss1;
-  *sss2 = ss2;
-  *sss3 = ss3;
-  *sst = st;
-}
+  if (midtexel)
+  {
+    __m128i adj = _mm_sub_epi32(_mm_sub_epi32(c3, c0), _mm_set1_epi32(1));
+    adj = _mm_add_epi32(_mm_slli_epi32(adj, 6), _mm_set1_epi32(0xc0));
+    sum = _mm_srai_epi32(_mm_add_epi32(sum, adj), 8);
+  }
+  else if (convert)
+    sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(0x80)), 8);
+  else
+    sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(0x10)), 5);
 
-static void tc_pipeline_load(int32_t* sss, int32_t* sst, int tilenum, int coord_quad)
-{
-  int sss1 = *sss, sst1 = *sst;
-  sss1 = SIGN16(sss1);
-  sst1 = SIGN16(sst1);
+  sum = _mm_and_si128(_mm_add_epi32(sum, base), _mm_set1_epi32(0x1ff));
+  _mm_storeu_si128((__m128i*) TEX, sum);
+#else
+  int32_t invt0r, invt0g, invt0b, invt0a;
+  int32_t invsf, invtf;
+
+  if (!midtexel)
+  {
+    if (!convert)
+    {
+      if (UPPER)
+      {
+        invsf = 0x20 - sfrac;
+        invtf = 0x20 - tfrac;
+        TEX->r = t3->r + ((((invsf * (t2->r - t3->r)) + (invtf * (t1->r - t3->r))) + 0x10) >> 5);
+        TEX->g = t3->g + ((((invsf * (t2->g - t3->g)) + (invtf * (t1->g - t3->g))) + 0x10) >> 5);
+        TEX->b = t3->b + ((((invsf * (t2->b - t3->b)) + (invtf * (t1->b - t3->b))) + 0x10) >> 5);
+        TEX->a = t3->a + ((((invsf * (t2->a - t3->a)) + (invtf * (t1->a - t3->a))) + 0x10) >> 5);
+      }
+      else
+      {
+        TEX->r = t0->r + ((((sfrac * (t1->r - t0->r)) + (tfrac * (t2->r - t0->r))) + 0x10) >> 5);
+        TEX->g = t0->g + ((((sfrac * (t1->g - t0->g)) + (tfrac * (t2->g - t0->g))) + 0x10) >> 5);
+        TEX->b = t0->b + ((((sfrac * (t1->b - t0->b)) + (tfrac * (t2->b - t0->b))) + 0x10) >> 5);
+        TEX->a = t0->a + ((((sfrac * (t1->a - t0->a)) + (tfrac * (t2->a - t0->a))) + 0x10) >> 5);
+      }
+    }
+    else
+    {
+      if (UPPER)
+      {
+        TEX->r = prev->b + ((((prev->r * (t2->r - t3->r)) + (prev->g * (t1->r - t3->r))) + 0x80) >> 8);
+        TEX->g = prev->b + ((((prev->r * (t2->g - t3->g)) + (prev->g * (t1->g - t3->g))) + 0x80) >> 8);
+        TEX->b = prev->b + ((((prev->r * (t2->b - t3->b)) + (prev->g * (t1->b - t3->b))) + 0x80) >> 8);
+        TEX->a = prev->b + ((((prev->r * (t2->a - t3->a)) + (prev->g * (t1->a - t3->a))) + 0x80) >> 8);
+      }
+      else
+      {
+        TEX->r = prev->b + ((((prev->r * (t1->r - t0->r)) + (prev->g * (t2->r - t0->r))) + 0x80) >> 8);
+        TEX->g = prev->b + ((((prev->r * (t1->g - t0->g)) + (prev->g * (t2->g - t0->g))) + 0x80) >> 8);
+        TEX->b = prev->b + ((((prev->r * (t1->b - t0->b)) + (prev->g * (t2->b - t0->b))) + 0x80) >> 8);
+        TEX->a = prev->b + ((((prev->r * (t1->a - t0->a)) + (prev->g * (t2->a - t0->a))) + 0x80) >> 8);
+      }
+    }
+  }
+  else
+  {
+    invt0r = ~t0->r; invt0g = ~t0->g; invt0b = ~t0->b; invt0a = ~t0->a;
+    if (!convert)
+    {
+      sfrac <<= 2;
+      tfrac <<= 2;
+      TEX->r = t0->r + ((((sfrac * (t1->r - t0->r)) + (tfrac * (t2->r - t0->r))) + ((invt0r + t3->r) << 6) + 0xc0) >> 8);
+      TEX->g = t0->g + ((((sfrac * (t1->g - t0->g)) + (tfrac * (t2->g - t0->g))) + ((invt0g + t3->g) << 6) + 0xc0) >> 8);
+      TEX->b = t0->b + ((((sfrac * (t1->b - t0->b)) + (tfrac * (t2->b - t0->b))) + ((invt0b + t3->b) << 6) + 0xc0) >> 8);
+      TEX->a = t0->a + ((((sfrac * (t1->a - t0->a)) + (tfrac * (t2->a - t0->a))) + ((invt0a + t3->a) << 6) + 0xc0) >> 8);
+    }
+    else
+    {
+      TEX->r = prev->b + ((((prev->r * (t1->r - t0->r)) + (prev->g * (t2->r - t0->r))) + ((invt0r + t3->r) << 6) + 0xc0) >> 8);
+      TEX->g = prev->b + ((((prev->r * (t1->g - t0->g)) + (prev->g * (t2->g - t0->g))) + ((invt0g + t3->g) << 6) + 0xc0) >> 8);
+      TEX->b = prev->b + ((((prev->r * (t1->b - t0->b)) + (prev->g * (t2->b - t0->b))) + ((invt0b + t3->b) << 6) + 0xc0) >> 8);
+      TEX->a = prev->b + ((((prev->r * (t1->a - t0->a)) + (prev->g * (t2->a - t0->a))) + ((invt0a + t3->a) << 6) + 0xc0) >> 8);
+    }
+  }
+
+  TEX->r &= 0x1ff;
+  TEX->g &= 0x1ff;
+  TEX->b &= 0x1ff;
+  TEX->a &= 0x1ff;
+#endif
+}
+
+static void texture_convert(COLOR* TEX, const COLOR* t0)
+{
+#ifdef USE_SSE
+  __m128i rg = _mm_set1_epi32((SIGN(t0->g, 9) << 16) | (SIGN(t0->r, 9) & 0xffff));
+  __m128i sum = _mm_madd_epi16(rg, _mm_load_si128((__m128i*) convert_kvec));
+
+  sum = _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(0x80)), 8);
+  sum = _mm_add_epi32(sum, _mm_set1_epi32(t0->b));
+  sum = _mm_and_si128(sum, _mm_set1_epi32(0x1ff));
+  _mm_storeu_si128((__m128i*) TEX, sum);
+#else
+  int32_t newk0, newk1, newk2, newk3, invk0, invk1, invk2, invk3;
+  int32_t r, g, b;
+
+  newk0 = SIGN(k0, 9);
+  newk1 = SIGN(k1, 9);
+  newk2 = SIGN(k2, 9);
+  newk3 = SIGN(k3, 9);
+  invk0 = ~newk0;
+  invk1 = ~newk1;
+  invk2 = ~newk2;
+  invk3 = ~newk3;
+  r = SIGN(t0->r, 9);
+  g = SIGN(t0->g, 9);
+  b = SIGN(t0->b, 9);
+  TEX->r = b + ((((newk0 - invk0) * g) + 0x80) >> 8);
+  TEX->g = b + ((((newk1 - invk1) * r + (newk2 - invk2) * g) + 0x80) >> 8);
+  TEX->b = b + ((((newk3 - invk3) * r) + 0x80) >> 8);
+  TEX->a = b;
+  TEX->r &= 0x1ff;
+  TEX->g &= 0x1ff;
+  TEX->b &= 0x1ff;
+  TEX->a &= 0x1ff;
+#endif
+}
+
+static void tc_pipeline_copy(int32_t* sss0, int32_t* sss1, int32_t* sss2, int32_t* sss3, int32_t* sst, int tilenum)                     
+{
+  int ss0 = *sss0, ss1 = 0, ss2 = 0, ss3 = 0, st = *sst;
+
+  tcshift_copy(&ss0, &st, tilenum);
+  
+  
+
+  ss0 = TRELATIVE(ss0, tile[tilenum].sl);
+  st = TRELATIVE(st, tile[tilenum].tl);
+  ss0 = (ss0 >> 5);
+  st = (st >> 5);
+
+  ss1 = ss0 + 1;
+  ss2 = ss0 + 2;
+  ss3 = ss0 + 3;
+
+  tcmask_copy(&ss0, &ss1, &ss2, &ss3, &st, tilenum);  
+
+  *sss0 = ss0;
+  *sss1 = ss1;
+  *sss2 = ss2;
+  *sss3 = ss3;
+  *sst = st;
+}
+
+/*
+ * Shift, clamp and mask/mirror the (s, t) pair of a sample together with
+ * its (s + 1, t + 1) neighbours. The lanes are laid out as (s, t, s2, t2)
+ * and driven by the constants precomputed per tile in FAKETILE, so none
+ * of the clamp or mirror decisions need a branch. The neighbours and the
+ * fractions are only meaningful for sample_type; the point-sampled path
+ * just uses the clamped and masked (s, t).
+ */
+static void tc_pipeline_cycle(int32_t* sss1, int32_t* sss2, int32_t* sst1, int32_t* sst2, int32_t* sfrac, int32_t* tfrac, int32_t SSS, int32_t SST, uint32_t tilenum)
+{
+#ifdef USE_SSE
+  const FAKETILE* f = &tile[tilenum].f;
+  int32_t st[4] align(16);
+  int32_t fr[4] align(16);
+  __m128i coord, shifts, shiftt, maxst, bit16, clamped, frac;
+
+  shifts = _mm_sra_epi32(_mm_sll_epi32(_mm_cvtsi32_si128(SSS), f->shl_s), f->shr_s);
+  shiftt = _mm_sra_epi32(_mm_sll_epi32(_mm_cvtsi32_si128(SST), f->shl_t), f->shr_t);
+  coord = _mm_unpacklo_epi32(shifts, shiftt);
+  coord = _mm_unpacklo_epi64(coord, coord);
+
+  maxst = _mm_cmpgt_epi32(_mm_srai_epi32(coord, 3), f->maxst);
+  coord = _mm_sub_epi32(coord, f->relative);
+  frac = _mm_and_si128(coord, _mm_set1_epi32(0x1f));
+
+  bit16 = _mm_and_si128(coord, _mm_set1_epi32(0x10000));
+  bit16 = _mm_cmpeq_epi32(bit16, _mm_set1_epi32(0x10000));
+  maxst = _mm_andnot_si128(bit16, maxst);
+  clamped = _mm_and_si128(_mm_or_si128(bit16, maxst), f->clampen);
+  maxst = _mm_and_si128(maxst, f->clampen);
+
+  coord = _mm_andnot_si128(clamped, _mm_srai_epi32(coord, 5));
+  coord = _mm_or_si128(coord, _mm_and_si128(maxst, f->clampdiff));
+  frac = _mm_andnot_si128(clamped, frac);
+
+  coord = _mm_add_epi32(coord, f->coupled);
+  coord = _mm_xor_si128(coord, _mm_cmpgt_epi32(
+    _mm_and_si128(coord, f->wrapbit), _mm_setzero_si128()));
+  coord = _mm_and_si128(coord, f->maskbits);
+
+  _mm_store_si128((__m128i*) st, coord);
+  _mm_store_si128((__m128i*) fr, frac);
+  *sss1 = st[0];
+  *sst1 = st[1];
+  *sss2 = st[2];
+  *sst2 = st[3];
+  *sfrac = fr[0];
+  *tfrac = fr[1];
+#else
+  int32_t maxs, maxt;
+  int32_t ss = SSS, st = SST;
+
+  tcshift_cycle(&ss, &st, &maxs, &maxt, tilenum);
+
+  ss = TRELATIVE(ss, tile[tilenum].sl);
+  st = TRELATIVE(st, tile[tilenum].tl);
+
+  *sfrac = ss & 0x1f;
+  *tfrac = st & 0x1f;
+
+  tcclamp_cycle(&ss, &st, sfrac, tfrac, maxs, maxt, tilenum);
+
+  *sss1 = ss;
+  *sst1 = st;
+  *sss2 = ss + (tile[tilenum].format != FORMAT_YUV ? 1 : 2);
+  *sst2 = st + 1;
+
+  tcmask_coupled(sss1, sss2, sst1, sst2, tilenum);
+#endif
+}
+
+static void tc_pipeline_load(int32_t* sss, int32_t* sst, int tilenum, int coord_quad)
+{
+  int sss1 = *sss, sst1 = *sst;
+  sss1 = SIGN16(sss1);
+  sst1 = SIGN16(sst1);
 
   
   sss1 = TRELATIVE(sss1, tile[tilenum].sl);
@@ -3472,7 +3923,15 @@ static void tc_pipeline_load(int32_t* sss, int32_t* sst, int tilenum, int coord_
   *sst = sst1;
 }
 
-void render_spans_1cycle_complete(int start, int end, int tilenum, int flip)
+/*
+ * The 1-cycle span loops come in two flavours. The opaque ones are picked
+ * by deduce_derivatives when nothing can read the framebuffer colour or
+ * blend (see opaque_1cycle): they skip the per-pixel framebuffer read,
+ * whose coverage is a constant 7 with image_read_en off, and go straight
+ * from alpha compare to dither. The last pixel of each line is still read
+ * so memory_color is left exactly as a 2-cycle primitive expects it.
+ */
+static forceinline void render_spans_1cycle_complete_generic(int start, int end, int tilenum, int flip, int opaque)
 {
   int zb = zb_address >> 1;
   int zbcur;
@@ -3515,23 +3974,29 @@ void render_spans_1cycle_complete(int start, int end, int tilenum, int flip)
   int curpixel = 0;
   int x, length, scdiff;
   uint32_t fir, fig, fib;
+  int32_t zrunsz[4];
+  uint32_t zmask = 0, zwrite = 0, zrunbase = 0;
+  int zleft = 0, zline;
+  int earlyz = other_modes.f.early_z_1cycle;
+  uint32_t zpass, shade;
+  int zhidden;
           
   for (i = start; i <= end; i++)
   {
-    if (span[i].validline)
+    if (span.validline[i])
     {
 
-    xstart = span[i].lx;
-    xend = span[i].unscrx;
-    xendsc = span[i].rx;
-    r = span[i].r;
-    g = span[i].g;
-    b = span[i].b;
-    a = span[i].a;
-    z = other_modes.z_source_sel ? primitive_z : span[i].z;
-    s = span[i].s;
-    t = span[i].t;
-    w = span[i].w;
+    xstart = span.lx[i];
+    xend = span.unscrx[i];
+    xendsc = span.rx[i];
+    r = span.r[i];
+    g = span.g[i];
+    b = span.b[i];
+    a = span.a[i];
+    z = other_modes.z_source_sel ? primitive_z : span.z[i];
+    s = span.s[i];
+    t = span.t[i];
+    w = span.w[i];
 
     x = xendsc;
     curpixel = fb_width * i + x;
@@ -3568,6 +4033,14 @@ void render_spans_1cycle_complete(int start, int end, int tilenum, int flip)
     }
     sigs.startspan = 1;
 
+    zhidden = earlyz && hiz_line_rejected(i, x, xinc, length, z, dincs[SPAN_DZ], dzpix);
+    if (zhidden)
+      irand_skip(length * other_modes.f.noise_draws);
+    pixq_begin_line(curpixel, length, xinc);
+    fbrow_begin_line(curpixel, length, xinc, zhidden);
+
+    zline = !zhidden && opaque && other_modes.f.zrun_1cycle && z_run_line_ok(curpixel, length, xinc);
+
     for (j = 0; j <= length; j++)
     {
       sr = r >> 14;
@@ -3583,7 +4056,38 @@ void render_spans_1cycle_complete(int start, int end, int tilenum, int flip)
       sigs.endspan = (j == length);
       sigs.preendspan = (j == (length - 1));
 
-      lookup_cvmask_derivatives(cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+      lookup_span_cvg(x, &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+
+      if (zline && !zleft && j + 3 < length)
+      {
+        zmask = z_test_run(zrunsz, zbcur, x, xinc, z, dincs[SPAN_DZ], dzpix);
+        zrunbase = zbcur;
+        zwrite = 0;
+        zleft = 4;
+      }
+
+      if (zleft)
+      {
+        zpass = zmask & 1;
+        if (zpass)
+          rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+        blend_en = 0;
+        curpixel_memcvg = 7;
+      }
+      else if (zhidden && j < length)
+        zpass = 0;
+      else if (earlyz)
+      {
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+        if (!opaque || j == length)
+          fbread1_ptr(curpixel, &curpixel_memcvg);
+        else
+          curpixel_memcvg = 7;
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      else
+        zpass = 1;
+      shade = zpass || j == length;
       
 
       get_texel1_1cycle(&news, &newt, s, t, w, dincs[SPAN_DS], dincs[SPAN_DT], dincs[SPAN_DW], i, &sigs);
@@ -3605,7 +4109,8 @@ void render_spans_1cycle_complete(int start, int end, int tilenum, int flip)
         
         
         
-        texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
+        if (shade)
+          texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
 
         
         sigs.startspan = 0;
@@ -3621,23 +4126,46 @@ void render_spans_1cycle_complete(int start, int end, int tilenum, int flip)
       
       tclod_1cycle_next(&news, &newt, s, t, w, dincs[SPAN_DS], dincs[SPAN_DT], dincs[SPAN_DW], i, prim_tile, &newtile, &sigs, &prelodfrac);      
       
-      texture_pipeline_cycle(&texel1_color, &texel1_color, news, newt, newtile, 0);
-
-      rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
-
-      get_dither_noise_ptr(x, i, &cdith, &adith);
-      combiner_1cycle(adith, &curpixel_cvg);
+      /* texel1 becomes the next pixel's texel0, so a run only skips it when
+         neither this pixel nor the next one in the run passed. */
+      if (!zleft || (zmask & 3) || zleft == 1)
+        texture_pipeline_cycle(&texel1_color, &texel1_color, news, newt, newtile, 0);
+
+      if (!zleft && !earlyz)
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+
+      if (!zhidden || j == length)
+        get_dither_noise_ptr(x, i, &cdith, &adith);
+      if (shade)
+        combiner_1cycle(adith, &curpixel_cvg);
         
-      fbread1_ptr(curpixel, &curpixel_memcvg);
-      if (z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+      if (!zleft && !earlyz)
+      {
+        if (!opaque || j == length)
+          fbread1_ptr(curpixel, &curpixel_memcvg);
+        else
+          curpixel_memcvg = 7;
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      if (zpass)
       {
-        if (blender_1cycle(&fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+        if (opaque ? blender_1cycle_opaque(&fir, &fig, &fib, curpixel_cvbit) :
+          blender_1cycle(&fir, &fig, &fib, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
         {
-          fbwrite_ptr(curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-          if (other_modes.z_update_en)
+          pixq_push(curpixel, fir, fig, fib, cdith, blend_en, curpixel_cvg, curpixel_memcvg);
+          if (zleft)
+            zwrite |= 0x10;
+          else if (other_modes.z_update_en)
             z_store(zbcur, sz, dzpixenc);
         }
       }
+      if (zleft)
+      {
+        zmask >>= 1;
+        zwrite >>= 1;
+        if (!--zleft && other_modes.z_update_en)
+          z_store_run(zrunbase, xinc, zrunsz, dzpixenc, zwrite);
+      }
 
       
       
@@ -3652,11 +4180,22 @@ void render_spans_1cycle_complete(int start, int end, int tilenum, int flip)
       curpixel += xinc;
       zbcur += xinc;
     }
+    pixq_flush();
     }
   }
 }
 
-void render_spans_1cycle_notexel1(int start, int end, int tilenum, int flip)
+void render_spans_1cycle_complete(int start, int end, int tilenum, int flip)
+{
+  render_spans_1cycle_complete_generic(start, end, tilenum, flip, 0);
+}
+
+void render_spans_1cycle_complete_opaque(int start, int end, int tilenum, int flip)
+{
+  render_spans_1cycle_complete_generic(start, end, tilenum, flip, 1);
+}
+
+static forceinline void render_spans_1cycle_notexel1_generic(int start, int end, int tilenum, int flip, int opaque)
 {
   int zb = zb_address >> 1;
   int zbcur;
@@ -3697,17 +4236,29 @@ void render_spans_1cycle_notexel1(int start, int end, int tilenum, int flip)
   int curpixel = 0;
   int x, length, scdiff;
   uint32_t fir, fig, fib;
+  int32_t zrunsz[4];
+  uint32_t zmask = 0, zwrite = 0, zrunbase = 0;
+  int zleft = 0, zline;
+  int earlyz = other_modes.f.early_z_1cycle;
+  uint32_t zpass, shade;
+  int zhidden;
           
   for (i = start; i <= end; i++) {
-    if (!span[i].validline)
+    if (!span.validline[i])
       continue;
 
-  xstart = span[i].lx;
-  xend = span[i].unscrx;
-  xendsc = span[i].rx;
+  xstart = span.lx[i];
+  xend = span.unscrx[i];
+  xendsc = span.rx[i];
 
-  memcpy(localspan, &span[i].r, sizeof(localspan));
-  localspan[SPAN_DZ] = other_modes.z_source_sel ? primitive_z : span[i].z;
+  localspan[SPAN_DR] = span.r[i];
+  localspan[SPAN_DG] = span.g[i];
+  localspan[SPAN_DB] = span.b[i];
+  localspan[SPAN_DA] = span.a[i];
+  localspan[SPAN_DS] = span.s[i];
+  localspan[SPAN_DT] = span.t[i];
+  localspan[SPAN_DW] = span.w[i];
+  localspan[SPAN_DZ] = other_modes.z_source_sel ? primitive_z : span.z[i];
 
   x = xendsc;
   curpixel = fb_width * i + x;
@@ -3731,6 +4282,14 @@ void render_spans_1cycle_notexel1(int start, int end, int tilenum, int flip)
   MulConstant(accum, dincs, scdiff);
   AddVectors(localspan, localspan, accum);
 
+    zhidden = earlyz && hiz_line_rejected(i, x, xinc, length, localspan[SPAN_DZ], dincs[SPAN_DZ], dzpix);
+    if (zhidden)
+      irand_skip(length * other_modes.f.noise_draws);
+    pixq_begin_line(curpixel, length, xinc);
+    fbrow_begin_line(curpixel, length, xinc, zhidden);
+
+    zline = !zhidden && opaque && other_modes.f.zrun_1cycle && z_run_line_ok(curpixel, length, xinc);
+
     for (j = 0; j <= length; j++) {
 #ifdef USE_SSE
       __m128i data1 = _mm_load_si128((__m128i*) (localspan + 0));
@@ -3754,29 +4313,81 @@ void render_spans_1cycle_notexel1(int start, int end, int tilenum, int flip)
       sigs.endspan = (j == length);
       sigs.preendspan = (j == (length - 1));
 
-      lookup_cvmask_derivatives(cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+      lookup_span_cvg(x, &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+
+      if (zline && !zleft && j + 3 < length)
+      {
+        zmask = z_test_run(zrunsz, zbcur, x, xinc, localspan[SPAN_DZ], dincs[SPAN_DZ], dzpix);
+        zrunbase = zbcur;
+        zwrite = 0;
+        zleft = 4;
+      }
+
+      if (zleft)
+      {
+        zpass = zmask & 1;
+        if (zpass)
+          rgbaz_correct_clip(offx, offy, slocalspan[SPAN_DR], slocalspan[SPAN_DG], slocalspan[SPAN_DB], slocalspan[SPAN_DA], &slocalspan[SPAN_DZ], curpixel_cvg);
+        blend_en = 0;
+        curpixel_memcvg = 7;
+      }
+      else if (zhidden && j < length)
+        zpass = 0;
+      else if (earlyz)
+      {
+        rgbaz_correct_clip(offx, offy, slocalspan[SPAN_DR], slocalspan[SPAN_DG], slocalspan[SPAN_DB], slocalspan[SPAN_DA], &slocalspan[SPAN_DZ], curpixel_cvg);
+        if (!opaque || j == length)
+          fbread1_ptr(curpixel, &curpixel_memcvg);
+        else
+          curpixel_memcvg = 7;
+        zpass = z_compare(zbcur, slocalspan[SPAN_DZ], dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      else
+        zpass = 1;
+      shade = zpass || j == length;
 
       tcdiv_ptr(slocalspan[SPAN_DS], slocalspan[SPAN_DT], slocalspan[SPAN_DW], &sss, &sst);
 
       tclod_1cycle_current_simple(&sss, &sst, localspan + SPAN_DS, dincs + SPAN_DS, i, prim_tile, &tile1, &sigs);
 
-      texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
+      if (shade)
+        texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
 
-      rgbaz_correct_clip(offx, offy, slocalspan[SPAN_DR], slocalspan[SPAN_DG], slocalspan[SPAN_DB], slocalspan[SPAN_DA], &slocalspan[SPAN_DZ], curpixel_cvg);
+      if (!zleft && !earlyz)
+        rgbaz_correct_clip(offx, offy, slocalspan[SPAN_DR], slocalspan[SPAN_DG], slocalspan[SPAN_DB], slocalspan[SPAN_DA], &slocalspan[SPAN_DZ], curpixel_cvg);
 
-      get_dither_noise_ptr(x, i, &cdith, &adith);
-      combiner_1cycle(adith, &curpixel_cvg);
+      if (!zhidden || j == length)
+        get_dither_noise_ptr(x, i, &cdith, &adith);
+      if (shade)
+        combiner_1cycle(adith, &curpixel_cvg);
         
-      fbread1_ptr(curpixel, &curpixel_memcvg);
-      if (z_compare(zbcur, slocalspan[SPAN_DZ], dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+      if (!zleft && !earlyz)
+      {
+        if (!opaque || j == length)
+          fbread1_ptr(curpixel, &curpixel_memcvg);
+        else
+          curpixel_memcvg = 7;
+        zpass = z_compare(zbcur, slocalspan[SPAN_DZ], dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      if (zpass)
       {
-        if (blender_1cycle(&fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+        if (opaque ? blender_1cycle_opaque(&fir, &fig, &fib, curpixel_cvbit) :
+          blender_1cycle(&fir, &fig, &fib, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
         {
-          fbwrite_ptr(curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-          if (other_modes.z_update_en)
+          pixq_push(curpixel, fir, fig, fib, cdith, blend_en, curpixel_cvg, curpixel_memcvg);
+          if (zleft)
+            zwrite |= 0x10;
+          else if (other_modes.z_update_en)
             z_store(zbcur, slocalspan[SPAN_DZ], dzpixenc);
         }
       }
+      if (zleft)
+      {
+        zmask >>= 1;
+        zwrite >>= 1;
+        if (!--zleft && other_modes.z_update_en)
+          z_store_run(zrunbase, xinc, zrunsz, dzpixenc, zwrite);
+      }
 
       AddVectors(localspan, localspan, dincs);
       
@@ -3784,10 +4395,21 @@ void render_spans_1cycle_notexel1(int start, int end, int tilenum, int flip)
       curpixel += xinc;
       zbcur += xinc;
     }
+    pixq_flush();
   }
 }
 
-void render_spans_1cycle_notex(int start, int end, int tilenum, int flip)
+void render_spans_1cycle_notexel1(int start, int end, int tilenum, int flip)
+{
+  render_spans_1cycle_notexel1_generic(start, end, tilenum, flip, 0);
+}
+
+void render_spans_1cycle_notexel1_opaque(int start, int end, int tilenum, int flip)
+{
+  render_spans_1cycle_notexel1_generic(start, end, tilenum, flip, 1);
+}
+
+static forceinline void render_spans_1cycle_notex_generic(int start, int end, int tilenum, int flip, int opaque)
 {
   int zb = zb_address >> 1;
   int zbcur;
@@ -3822,20 +4444,26 @@ void render_spans_1cycle_notex(int start, int end, int tilenum, int flip)
   int curpixel = 0;
   int x, length, scdiff;
   uint32_t fir, fig, fib;
+  int32_t zrunsz[4];
+  uint32_t zmask = 0, zwrite = 0, zrunbase = 0;
+  int zleft = 0, zline;
+  int earlyz = other_modes.f.early_z_1cycle;
+  uint32_t zpass, shade;
+  int zhidden;
           
   for (i = start; i <= end; i++)
   {
-    if (span[i].validline)
+    if (span.validline[i])
     {
 
-    xstart = span[i].lx;
-    xend = span[i].unscrx;
-    xendsc = span[i].rx;
-    r = span[i].r;
-    g = span[i].g;
-    b = span[i].b;
-    a = span[i].a;
-    z = other_modes.z_source_sel ? primitive_z : span[i].z;
+    xstart = span.lx[i];
+    xend = span.unscrx[i];
+    xendsc = span.rx[i];
+    r = span.r[i];
+    g = span.g[i];
+    b = span.b[i];
+    a = span.a[i];
+    z = other_modes.z_source_sel ? primitive_z : span.z[i];
 
     x = xendsc;
     curpixel = fb_width * i + x;
@@ -3863,6 +4491,14 @@ void render_spans_1cycle_notex(int start, int end, int tilenum, int flip)
       z += (dincs[SPAN_DZ] * scdiff);
     }
 
+    zhidden = earlyz && hiz_line_rejected(i, x, xinc, length, z, dincs[SPAN_DZ], dzpix);
+    if (zhidden)
+      irand_skip(length * other_modes.f.noise_draws);
+    pixq_begin_line(curpixel, length, xinc);
+    fbrow_begin_line(curpixel, length, xinc, zhidden);
+
+    zline = !zhidden && opaque && other_modes.f.zrun_1cycle && z_run_line_ok(curpixel, length, xinc);
+
     for (j = 0; j <= length; j++)
     {
       sr = r >> 14;
@@ -3871,23 +4507,74 @@ void render_spans_1cycle_notex(int start, int end, int tilenum, int flip)
       sa = a >> 14;
       sz = (z >> 10) & 0x3fffff;
 
-      lookup_cvmask_derivatives(cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+      lookup_span_cvg(x, &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+
+      if (zline && !zleft && j + 3 < length)
+      {
+        zmask = z_test_run(zrunsz, zbcur, x, xinc, z, dincs[SPAN_DZ], dzpix);
+        zrunbase = zbcur;
+        zwrite = 0;
+        zleft = 4;
+      }
+
+      if (zleft)
+      {
+        zpass = zmask & 1;
+        if (zpass)
+          rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+        blend_en = 0;
+        curpixel_memcvg = 7;
+      }
+      else if (zhidden && j < length)
+        zpass = 0;
+      else if (earlyz)
+      {
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+        if (!opaque || j == length)
+          fbread1_ptr(curpixel, &curpixel_memcvg);
+        else
+          curpixel_memcvg = 7;
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      else
+        zpass = 1;
+      shade = zpass || j == length;
 
-      rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+      if (!zleft && !earlyz)
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
 
-      get_dither_noise_ptr(x, i, &cdith, &adith);
-      combiner_1cycle(adith, &curpixel_cvg);
+      if (!zhidden || j == length)
+        get_dither_noise_ptr(x, i, &cdith, &adith);
+      if (shade)
+        combiner_1cycle(adith, &curpixel_cvg);
         
-      fbread1_ptr(curpixel, &curpixel_memcvg);
-      if (z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+      if (!zleft && !earlyz)
+      {
+        if (!opaque || j == length)
+          fbread1_ptr(curpixel, &curpixel_memcvg);
+        else
+          curpixel_memcvg = 7;
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      if (zpass)
       {
-        if (blender_1cycle(&fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+        if (opaque ? blender_1cycle_opaque(&fir, &fig, &fib, curpixel_cvbit) :
+          blender_1cycle(&fir, &fig, &fib, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
         {
-          fbwrite_ptr(curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-          if (other_modes.z_update_en)
+          pixq_push(curpixel, fir, fig, fib, cdith, blend_en, curpixel_cvg, curpixel_memcvg);
+          if (zleft)
+            zwrite |= 0x10;
+          else if (other_modes.z_update_en)
             z_store(zbcur, sz, dzpixenc);
         }
       }
+      if (zleft)
+      {
+        zmask >>= 1;
+        zwrite >>= 1;
+        if (!--zleft && other_modes.z_update_en)
+          z_store_run(zrunbase, xinc, zrunsz, dzpixenc, zwrite);
+      }
       r += dincs[SPAN_DR];
       g += dincs[SPAN_DG];
       b += dincs[SPAN_DB];
@@ -3898,11 +4585,22 @@ void render_spans_1cycle_notex(int start, int end, int tilenum, int flip)
       curpixel += xinc;
       zbcur += xinc;
     }
+    pixq_flush();
     }
   }
 }
 
-void render_spans_2cycle_complete(int start, int end, int tilenum, int flip)
+void render_spans_1cycle_notex(int start, int end, int tilenum, int flip)
+{
+  render_spans_1cycle_notex_generic(start, end, tilenum, flip, 0);
+}
+
+void render_spans_1cycle_notex_opaque(int start, int end, int tilenum, int flip)
+{
+  render_spans_1cycle_notex_generic(start, end, tilenum, flip, 1);
+}
+
+static forceinline void render_spans_2cycle_complete_generic(int start, int end, int tilenum, int flip)
 {
   int zb = zb_address >> 1;
   int zbcur;
@@ -3950,23 +4648,26 @@ void render_spans_2cycle_complete(int start, int end, int tilenum, int flip)
   
   int x, length, scdiff;
   uint32_t fir, fig, fib;
+  int earlyz = other_modes.f.early_z_2cycle;
+  uint32_t zpass, shade;
+  int zhidden;
         
   for (i = start; i <= end; i++)
   {
-    if (span[i].validline)
+    if (span.validline[i])
     {
 
-    xstart = span[i].lx;
-    xend = span[i].unscrx;
-    xendsc = span[i].rx;
-    r = span[i].r;
-    g = span[i].g;
-    b = span[i].b;
-    a = span[i].a;
-    z = other_modes.z_source_sel ? primitive_z : span[i].z;
-    s = span[i].s;
-    t = span[i].t;
-    w = span[i].w;
+    xstart = span.lx[i];
+    xend = span.unscrx[i];
+    xendsc = span.rx[i];
+    r = span.r[i];
+    g = span.g[i];
+    b = span.b[i];
+    a = span.a[i];
+    z = other_modes.z_source_sel ? primitive_z : span.z[i];
+    s = span.s[i];
+    t = span.t[i];
+    w = span.w[i];
 
     x = xendsc;
     curpixel = fb_width * i + x;
@@ -4006,6 +4707,13 @@ void render_spans_2cycle_complete(int start, int end, int tilenum, int flip)
     }
     sigs.startspan = 1;
 
+    zhidden = earlyz && hiz_line_rejected(i, x, xinc, length - 1, z, dincs[SPAN_DZ], dzpix);
+    if (zhidden)
+      irand_skip((length - 1) * other_modes.f.noise_draws);
+    pixq_begin_line(curpixel, length, xinc);
+    fbrow_begin_line(curpixel, length, xinc, zhidden);
+
+
     for (j = 0; j <= length; j++)
     {
       sr = r >> 14;
@@ -4018,7 +4726,19 @@ void render_spans_2cycle_complete(int start, int end, int tilenum, int flip)
       sz = (z >> 10) & 0x3fffff;
       
 
-      lookup_cvmask_derivatives(cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+      lookup_span_cvg(x, &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+
+      if (zhidden && j < length - 1)
+        zpass = 0;
+      else if (earlyz)
+      {
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+        fbread2_ptr(curpixel, &curpixel_memcvg);
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      else
+        zpass = 1;
+      shade = zpass || j == length;
 
       get_nexttexel0_2cycle(&news, &newt, s, t, w, dincs[SPAN_DS], dincs[SPAN_DT], dincs[SPAN_DW]);
       
@@ -4036,8 +4756,11 @@ void render_spans_2cycle_complete(int start, int end, int tilenum, int flip)
         
 
         
-        texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
-        texture_pipeline_cycle(&texel1_color, &texel0_color, sss, sst, tile2, 1);
+        if (shade)
+        {
+          texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
+          texture_pipeline_cycle(&texel1_color, &texel0_color, sss, sst, tile2, 1);
+        }
 
         sigs.startspan = 0;
       }
@@ -4051,23 +4774,24 @@ void render_spans_2cycle_complete(int start, int end, int tilenum, int flip)
       texture_pipeline_cycle(&nexttexel_color, &nexttexel_color, news, newt, newtile1, 0);
       texture_pipeline_cycle(&nexttexel1_color, &nexttexel_color, news, newt, newtile2, 1);
 
-      rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+      if (!earlyz)
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
           
-      get_dither_noise_ptr(x, i, &cdith, &adith);
-      combiner_2cycle(adith, &curpixel_cvg);
+      if (!zhidden || j >= length - 1)
+        get_dither_noise_ptr(x, i, &cdith, &adith);
+      if (shade)
+        combiner_2cycle(adith, &curpixel_cvg);
         
-      fbread2_ptr(curpixel, &curpixel_memcvg);
-      
-      
-      
-      
-      
-      
-      if (z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+      if (!earlyz)
+      {
+        fbread2_ptr(curpixel, &curpixel_memcvg);
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      if (zpass)
       {
-        if (blender_2cycle(&fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+        if (blender_2cycle(&fir, &fig, &fib, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
         {
-          fbwrite_ptr(curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
+          pixq_push(curpixel, fir, fig, fib, cdith, blend_en, curpixel_cvg, curpixel_memcvg);
           if (other_modes.z_update_en)
             z_store(zbcur, sz, dzpixenc);
           
@@ -4097,11 +4821,12 @@ void render_spans_2cycle_complete(int start, int end, int tilenum, int flip)
       curpixel += xinc;
       zbcur += xinc;
     }
+    pixq_flush();
     }
   }
 }
 
-void render_spans_2cycle_notexelnext(int start, int end, int tilenum, int flip)
+static forceinline void render_spans_2cycle_notexelnext_generic(int start, int end, int tilenum, int flip)
 {
   int zb = zb_address >> 1;
   int zbcur;
@@ -4142,23 +4867,26 @@ void render_spans_2cycle_notexelnext(int start, int end, int tilenum, int flip)
   
   int x, length, scdiff;
   uint32_t fir, fig, fib;
+  int earlyz = other_modes.f.early_z_2cycle;
+  uint32_t zpass, shade;
+  int zhidden;
         
   for (i = start; i <= end; i++)
   {
-    if (span[i].validline)
+    if (span.validline[i])
     {
 
-    xstart = span[i].lx;
-    xend = span[i].unscrx;
-    xendsc = span[i].rx;
-    r = span[i].r;
-    g = span[i].g;
-    b = span[i].b;
-    a = span[i].a;
-    z = other_modes.z_source_sel ? primitive_z : span[i].z;
-    s = span[i].s;
-    t = span[i].t;
-    w = span[i].w;
+    xstart = span.lx[i];
+    xend = span.unscrx[i];
+    xendsc = span.rx[i];
+    r = span.r[i];
+    g = span.g[i];
+    b = span.b[i];
+    a = span.a[i];
+    z = other_modes.z_source_sel ? primitive_z : span.z[i];
+    s = span.s[i];
+    t = span.t[i];
+    w = span.w[i];
 
     x = xendsc;
     curpixel = fb_width * i + x;
@@ -4189,6 +4917,13 @@ void render_spans_2cycle_notexelnext(int start, int end, int tilenum, int flip)
       w += (dincs[SPAN_DW] * scdiff);
     }
 
+    zhidden = earlyz && hiz_line_rejected(i, x, xinc, length - 1, z, dincs[SPAN_DZ], dzpix);
+    if (zhidden)
+      irand_skip((length - 1) * other_modes.f.noise_draws);
+    pixq_begin_line(curpixel, length, xinc);
+    fbrow_begin_line(curpixel, length, xinc, zhidden);
+
+
     for (j = 0; j <= length; j++)
     {
       sr = r >> 14;
@@ -4200,27 +4935,48 @@ void render_spans_2cycle_notexelnext(int start, int end, int tilenum, int flip)
       sw = w >> 16;
       sz = (z >> 10) & 0x3fffff;
 
-      lookup_cvmask_derivatives(cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+      lookup_span_cvg(x, &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+
+      if (zhidden && j < length - 1)
+        zpass = 0;
+      else if (earlyz)
+      {
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+        fbread2_ptr(curpixel, &curpixel_memcvg);
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      else
+        zpass = 1;
+      shade = zpass || j == length;
       
       tcdiv_ptr(ss, st, sw, &sss, &sst);
 
       tclod_2cycle_current_simple(&sss, &sst, s, t, w, dincs[SPAN_DS], dincs[SPAN_DT], dincs[SPAN_DW], prim_tile, &tile1, &tile2);
         
-      texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
-      texture_pipeline_cycle(&texel1_color, &texel0_color, sss, sst, tile2, 1);
+      if (shade)
+      {
+        texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
+        texture_pipeline_cycle(&texel1_color, &texel0_color, sss, sst, tile2, 1);
+      }
 
-      rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+      if (!earlyz)
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
           
-      get_dither_noise_ptr(x, i, &cdith, &adith);
-      combiner_2cycle(adith, &curpixel_cvg);
+      if (!zhidden || j >= length - 1)
+        get_dither_noise_ptr(x, i, &cdith, &adith);
+      if (shade)
+        combiner_2cycle(adith, &curpixel_cvg);
         
-      fbread2_ptr(curpixel, &curpixel_memcvg);
-
-      if (z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+      if (!earlyz)
+      {
+        fbread2_ptr(curpixel, &curpixel_memcvg);
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      if (zpass)
       {
-        if (blender_2cycle(&fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+        if (blender_2cycle(&fir, &fig, &fib, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
         {
-          fbwrite_ptr(curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
+          pixq_push(curpixel, fir, fig, fib, cdith, blend_en, curpixel_cvg, curpixel_memcvg);
           if (other_modes.z_update_en)
             z_store(zbcur, sz, dzpixenc);
         }
@@ -4242,11 +4998,12 @@ void render_spans_2cycle_notexelnext(int start, int end, int tilenum, int flip)
       curpixel += xinc;
       zbcur += xinc;
     }
+    pixq_flush();
     }
   }
 }
 
-void render_spans_2cycle_notexel1(int start, int end, int tilenum, int flip)
+static forceinline void render_spans_2cycle_notexel1_generic(int start, int end, int tilenum, int flip)
 {
   int zb = zb_address >> 1;
   int zbcur;
@@ -4286,23 +5043,26 @@ void render_spans_2cycle_notexel1(int start, int end, int tilenum, int flip)
   
   int x, length, scdiff;
   uint32_t fir, fig, fib;
+  int earlyz = other_modes.f.early_z_2cycle;
+  uint32_t zpass, shade;
+  int zhidden;
         
   for (i = start; i <= end; i++)
   {
-    if (span[i].validline)
+    if (span.validline[i])
     {
 
-    xstart = span[i].lx;
-    xend = span[i].unscrx;
-    xendsc = span[i].rx;
-    r = span[i].r;
-    g = span[i].g;
-    b = span[i].b;
-    a = span[i].a;
-    z = other_modes.z_source_sel ? primitive_z : span[i].z;
-    s = span[i].s;
-    t = span[i].t;
-    w = span[i].w;
+    xstart = span.lx[i];
+    xend = span.unscrx[i];
+    xendsc = span.rx[i];
+    r = span.r[i];
+    g = span.g[i];
+    b = span.b[i];
+    a = span.a[i];
+    z = other_modes.z_source_sel ? primitive_z : span.z[i];
+    s = span.s[i];
+    t = span.t[i];
+    w = span.w[i];
 
     x = xendsc;
     curpixel = fb_width * i + x;
@@ -4333,6 +5093,13 @@ void render_spans_2cycle_notexel1(int start, int end, int tilenum, int flip)
       w += (dincs[SPAN_DW] * scdiff);
     }
 
+    zhidden = earlyz && hiz_line_rejected(i, x, xinc, length - 1, z, dincs[SPAN_DZ], dzpix);
+    if (zhidden)
+      irand_skip((length - 1) * other_modes.f.noise_draws);
+    pixq_begin_line(curpixel, length, xinc);
+    fbrow_begin_line(curpixel, length, xinc, zhidden);
+
+
     for (j = 0; j <= length; j++)
     {
       sr = r >> 14;
@@ -4344,27 +5111,46 @@ void render_spans_2cycle_notexel1(int start, int end, int tilenum, int flip)
       sw = w >> 16;
       sz = (z >> 10) & 0x3fffff;
 
-      lookup_cvmask_derivatives(cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+      lookup_span_cvg(x, &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+
+      if (zhidden && j < length - 1)
+        zpass = 0;
+      else if (earlyz)
+      {
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+        fbread2_ptr(curpixel, &curpixel_memcvg);
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      else
+        zpass = 1;
+      shade = zpass || j == length;
       
       tcdiv_ptr(ss, st, sw, &sss, &sst);
 
       tclod_2cycle_current_notexel1(&sss, &sst, s, t, w, dincs[SPAN_DS], dincs[SPAN_DT], dincs[SPAN_DW], prim_tile, &tile1);
       
       
-      texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
+      if (shade)
+        texture_pipeline_cycle(&texel0_color, &texel0_color, sss, sst, tile1, 0);
 
-      rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+      if (!earlyz)
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
           
-      get_dither_noise_ptr(x, i, &cdith, &adith);
-      combiner_2cycle(adith, &curpixel_cvg);
+      if (!zhidden || j >= length - 1)
+        get_dither_noise_ptr(x, i, &cdith, &adith);
+      if (shade)
+        combiner_2cycle(adith, &curpixel_cvg);
         
-      fbread2_ptr(curpixel, &curpixel_memcvg);
-
-      if (z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+      if (!earlyz)
+      {
+        fbread2_ptr(curpixel, &curpixel_memcvg);
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      if (zpass)
       {
-        if (blender_2cycle(&fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+        if (blender_2cycle(&fir, &fig, &fib, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
         {
-          fbwrite_ptr(curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
+          pixq_push(curpixel, fir, fig, fib, cdith, blend_en, curpixel_cvg, curpixel_memcvg);
           if (other_modes.z_update_en)
             z_store(zbcur, sz, dzpixenc);
         }
@@ -4386,11 +5172,12 @@ void render_spans_2cycle_notexel1(int start, int end, int tilenum, int flip)
       curpixel += xinc;
       zbcur += xinc;
     }
+    pixq_flush();
     }
   }
 }
 
-void render_spans_2cycle_notex(int start, int end, int tilenum, int flip)
+static forceinline void render_spans_2cycle_notex_generic(int start, int end, int tilenum, int flip)
 {
   int zb = zb_address >> 1;
   int zbcur;
@@ -4425,20 +5212,23 @@ void render_spans_2cycle_notex(int start, int end, int tilenum, int flip)
   
   int x, length, scdiff;
   uint32_t fir, fig, fib;
+  int earlyz = other_modes.f.early_z_2cycle;
+  uint32_t zpass, shade;
+  int zhidden;
         
   for (i = start; i <= end; i++)
   {
-    if (span[i].validline)
+    if (span.validline[i])
     {
 
-    xstart = span[i].lx;
-    xend = span[i].unscrx;
-    xendsc = span[i].rx;
-    r = span[i].r;
-    g = span[i].g;
-    b = span[i].b;
-    a = span[i].a;
-    z = other_modes.z_source_sel ? primitive_z : span[i].z;
+    xstart = span.lx[i];
+    xend = span.unscrx[i];
+    xendsc = span.rx[i];
+    r = span.r[i];
+    g = span.g[i];
+    b = span.b[i];
+    a = span.a[i];
+    z = other_modes.z_source_sel ? primitive_z : span.z[i];
 
     x = xendsc;
     curpixel = fb_width * i + x;
@@ -4466,6 +5256,13 @@ void render_spans_2cycle_notex(int start, int end, int tilenum, int flip)
       z += (dincs[SPAN_DZ] * scdiff);
     }
 
+    zhidden = earlyz && hiz_line_rejected(i, x, xinc, length - 1, z, dincs[SPAN_DZ], dzpix);
+    if (zhidden)
+      irand_skip((length - 1) * other_modes.f.noise_draws);
+    pixq_begin_line(curpixel, length, xinc);
+    fbrow_begin_line(curpixel, length, xinc, zhidden);
+
+
     for (j = 0; j <= length; j++)
     {
       sr = r >> 14;
@@ -4474,20 +5271,38 @@ void render_spans_2cycle_notex(int start, int end, int tilenum, int flip)
       sa = a >> 14;
       sz = (z >> 10) & 0x3fffff;
 
-      lookup_cvmask_derivatives(cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+      lookup_span_cvg(x, &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+
+      if (zhidden && j < length - 1)
+        zpass = 0;
+      else if (earlyz)
+      {
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+        fbread2_ptr(curpixel, &curpixel_memcvg);
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      else
+        zpass = 1;
+      shade = zpass || j == length;
 
-      rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
+      if (!earlyz)
+        rgbaz_correct_clip(offx, offy, sr, sg, sb, sa, &sz, curpixel_cvg);
           
-      get_dither_noise_ptr(x, i, &cdith, &adith);
-      combiner_2cycle(adith, &curpixel_cvg);
+      if (!zhidden || j >= length - 1)
+        get_dither_noise_ptr(x, i, &cdith, &adith);
+      if (shade)
+        combiner_2cycle(adith, &curpixel_cvg);
         
-      fbread2_ptr(curpixel, &curpixel_memcvg);
-
-      if (z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+      if (!earlyz)
       {
-        if (blender_2cycle(&fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+        fbread2_ptr(curpixel, &curpixel_memcvg);
+        zpass = z_compare(zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+      }
+      if (zpass)
+      {
+        if (blender_2cycle(&fir, &fig, &fib, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
         {
-          fbwrite_ptr(curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
+          pixq_push(curpixel, fir, fig, fib, cdith, blend_en, curpixel_cvg, curpixel_memcvg);
           if (other_modes.z_update_en)
             z_store(zbcur, sz, dzpixenc);
         }
@@ -4506,10 +5321,81 @@ void render_spans_2cycle_notex(int start, int end, int tilenum, int flip)
       curpixel += xinc;
       zbcur += xinc;
     }
+    pixq_flush();
     }
   }
 }
 
+void render_spans_2cycle_complete(int start, int end, int tilenum, int flip)
+{
+  render_spans_2cycle_complete_generic(start, end, tilenum, flip);
+}
+
+void render_spans_2cycle_notexelnext(int start, int end, int tilenum, int flip)
+{
+  render_spans_2cycle_notexelnext_generic(start, end, tilenum, flip);
+}
+
+void render_spans_2cycle_notexel1(int start, int end, int tilenum, int flip)
+{
+  render_spans_2cycle_notexel1_generic(start, end, tilenum, flip);
+}
+
+void render_spans_2cycle_notex(int start, int end, int tilenum, int flip)
+{
+  render_spans_2cycle_notex_generic(start, end, tilenum, flip);
+}
+
+#if defined(RDP_DISPATCH) && defined(__GNUC__)
+/*
+ * SSE4.1 and AVX2 copies of the span renderers for SelectISA. Each one
+ * inlines the same generic body under a target attribute, so the compiler
+ * may use the wider ISA all through the span loops.
+ */
+#define RENDER_SPANS_1CYCLE_ISA(name, suffix, isa) \
+static __attribute__((target(isa), flatten)) void render_spans_1cycle_##name##_##suffix(int start, int end, int tilenum, int flip) \
+{ \
+  render_spans_1cycle_##name##_generic(start, end, tilenum, flip, 0); \
+} \
+static __attribute__((target(isa), flatten)) void render_spans_1cycle_##name##_opaque_##suffix(int start, int end, int tilenum, int flip) \
+{ \
+  render_spans_1cycle_##name##_generic(start, end, tilenum, flip, 1); \
+}
+
+#define RENDER_SPANS_2CYCLE_ISA(name, suffix, isa) \
+static __attribute__((target(isa), flatten)) void render_spans_2cycle_##name##_##suffix(int start, int end, int tilenum, int flip) \
+{ \
+  render_spans_2cycle_##name##_generic(start, end, tilenum, flip); \
+}
+
+#define RENDER_SPANS_ISA(suffix, isa) \
+RENDER_SPANS_1CYCLE_ISA(complete, suffix, isa) \
+RENDER_SPANS_1CYCLE_ISA(notexel1, suffix, isa) \
+RENDER_SPANS_1CYCLE_ISA(notex, suffix, isa) \
+RENDER_SPANS_2CYCLE_ISA(complete, suffix, isa) \
+RENDER_SPANS_2CYCLE_ISA(notexelnext, suffix, isa) \
+RENDER_SPANS_2CYCLE_ISA(notexel1, suffix, isa) \
+RENDER_SPANS_2CYCLE_ISA(notex, suffix, isa) \
+ \
+const SpanFuncTable SpanFuncs_##suffix = \
+{ \
+  {render_spans_1cycle_notex_##suffix, render_spans_1cycle_notexel1_##suffix, render_spans_1cycle_complete_##suffix}, \
+  {render_spans_1cycle_notex_opaque_##suffix, render_spans_1cycle_notexel1_opaque_##suffix, render_spans_1cycle_complete_opaque_##suffix}, \
+  {render_spans_2cycle_notex_##suffix, render_spans_2cycle_notexel1_##suffix, render_spans_2cycle_notexelnext_##suffix, render_spans_2cycle_complete_##suffix} \
+};
+
+RENDER_SPANS_ISA(sse41, "sse4.1")
+RENDER_SPANS_ISA(avx2, "avx2")
+
+#undef RENDER_SPANS_ISA
+#undef RENDER_SPANS_2CYCLE_ISA
+#undef RENDER_SPANS_1CYCLE_ISA
+#endif
+
+/*
+ * Lines are filled as byte runs, and runs that abut in RDRAM (full-width
+ * lines, a whole-screen or Z clear) are merged into one fbfill_bytes.
+ */
 void render_spans_fill(int start, int end, int flip)
 {
   if (fb_size == PIXEL_SIZE_4BIT) {
@@ -4519,36 +5405,37 @@ void render_spans_fill(int start, int end, int flip)
     return;
   }
 
-  int i, j;
-  int xinc = flip ? 1 : -1;
+  int i;
+  uint32_t base = fb_address & ~(PIXELS_TO_BYTES(1, fb_size) - 1);
+  uint32_t runstart = 0, runend = 0, linestart;
 
   int xstart = 0, xendsc;
-  int curpixel = 0;
-  int x, length;
+  int length;
         
   for (i = start; i <= end; i++) {
-    xstart = span[i].lx;
-    xendsc = span[i].rx;
+    xstart = span.lx[i];
+    xendsc = span.rx[i];
 
-    x = xendsc;
-    curpixel = fb_width * i + x;
     length = flip ? (xstart - xendsc) : (xendsc - xstart);
 
-    if (span[i].validline) {
+    if (span.validline[i]) {
 #ifndef NDEBUG
       int fastkillbits = other_modes.image_read_en ||
         other_modes.z_compare_en;
 
       if (fastkillbits && length >= 0) {
         debug("render_spans_fill: Pipeline crashed.");
-        return;
+        break;
       }
 #endif
       
-      for (j = 0; j <= length; j++) {
-        fbfill_ptr(curpixel);
-        x += xinc;
-        curpixel += xinc;
+      if (length >= 0) {
+        linestart = base + PIXELS_TO_BYTES(fb_width * i + (flip ? xendsc : xstart), fb_size);
+        if (linestart != runend) {
+          fbfill_bytes(runstart, runend);
+          runstart = linestart;
+        }
+        runend = linestart + PIXELS_TO_BYTES(length + 1, fb_size);
       }
 
 #ifndef NDEBUG
@@ -4557,11 +5444,13 @@ void render_spans_fill(int start, int end, int flip)
 
       if (slowkillbits && length >= 0) {
         debug("render_spans_fill: Pipeline crashed.");
-        return;
+        break;
       }
 #endif
     }
   }
+
+  fbfill_bytes(runstart, runend);
 }
 
 void render_spans_copy(int start, int end, int tilenum, int flip)
@@ -4604,15 +5493,15 @@ void render_spans_copy(int start, int end, int tilenum, int flip)
         
   for (i = start; i <= end; i++)
   {
-    if (span[i].validline)
+    if (span.validline[i])
     {
 
-    s = span[i].s;
-    t = span[i].t;
-    w = span[i].w;
+    s = span.s[i];
+    t = span.t[i];
+    w = span.w[i];
     
-    xstart = span[i].lx;
-    xendsc = span[i].rx;
+    xstart = span.lx[i];
+    xendsc = span.rx[i];
 
     fb_index = fb_width * i + xendsc;
     fbptr = fb_address + PIXELS_TO_BYTES_SPECIAL4(fb_index, fb_size);
@@ -4657,6 +5546,7 @@ void render_spans_copy(int start, int end, int tilenum, int flip)
       else if (fb_size == PIXEL_SIZE_8BIT)
       {
         alphamask = 0;
+        noise_seek(xendsc + (flip ? j : -j), i);
         threshold = (other_modes.dither_alpha_en) ? (irand() & 0xff) : blend_color.a;
         if (other_modes.dither_alpha_en)
         {
@@ -4779,10 +5669,10 @@ void loading_pipeline(int start, int end, int tilenum, int coord_quad, int ltlut
 
   for (i = start; i <= end; i++)
   {
-    xstart = span[i].lx;
-    xend = span[i].unscrx;
-    s = span[i].s;
-    t = span[i].t;
+    xstart = span.lx[i];
+    xend = span.unscrx[i];
+    s = span.s[i];
+    t = span.t[i];
 
     ti_index = ti_width * i + xend;
     tiptr = ti_address + PIXELS_TO_BYTES(ti_index, ti_size);
@@ -4955,17 +5845,190 @@ void loading_pipeline(int start, int end, int tilenum, int coord_quad, int ltlut
   }
 }
 
-enum EdgeWalkerType {
-  EW_R,
-  EW_G,
-  EW_B,
-  EW_A,
-  EW_S,
-  EW_T,
-  EW_W,
-  EW_Z,
-};
-
+static int loading_pipeline_rows_ok(int tilenum)
+{
+  if (tile[tilenum].format == FORMAT_YUV || tile[tilenum].size != ti_size)
+    return 0;
+
+  if (ti_size == PIXEL_SIZE_32BIT)
+    return tile[tilenum].format == FORMAT_RGBA;
+
+  return ti_size == PIXEL_SIZE_8BIT || ti_size == PIXEL_SIZE_16BIT;
+}
+
+static uint64_t rdram_read_qword(uint32_t address)
+{
+  uint64_t data;
+  assert(address <= 0x7FFFF8);
+  memcpy(&data, rdram_8 + address, sizeof(data));
+  return __builtin_bswap64(data);
+}
+
+/*
+ * LOAD_TILE for 8/16/32-bit non-YUV tiles whose size matches the texture
+ * image. The TMEM and RDRAM addresses are derived once per row (and again
+ * wherever the 16-bit S coordinate wraps), then the row is moved in blocks.
+ * Produces the same TMEM contents as loading_pipeline.
+ */
+void loading_pipeline_rows(int start, int end, int tilenum)
+{
+  int i, q, n, run;
+  int s, t, ss, sss, sst;
+  int length, nq, spanadvance, dsinc;
+  uint32_t tiptr, tbase, sshorts, count, oddrow;
+  uint16_t* tmem16 = (uint16_t*)TMEM;
+  uint64_t loadqword;
+  uint32_t readval0, readval1;
+
+  int sl = tile[tilenum].sl;
+  int tl = tile[tilenum].tl;
+  int rgba32 = (ti_size == PIXEL_SIZE_32BIT);
+
+#ifdef USE_SSE
+  static const uint8_t dswapmasks[2][16] align(16) = {
+    {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+    {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8},
+  };
+
+  static const uint8_t splitmasks[2][16] align(16) = {
+    {5, 4, 1, 0, 13, 12, 9, 8, 7, 6, 3, 2, 15, 14, 11, 10},
+    {13, 12, 9, 8, 5, 4, 1, 0, 15, 14, 11, 10, 7, 6, 3, 2},
+  };
+
+  __m128i mask, data;
+#endif
+
+  spanadvance = 8 >> (ti_size - 1);
+  dsinc = (spans[SPAN_DS] >> 16) & 0xffff;
+  assert(!(spans[SPAN_DS] & 0xffff) && dsinc);
+
+  for (i = start; i <= end; i++)
+  {
+    s = span.s[i];
+    t = span.t[i];
+
+    tiptr = ti_address + PIXELS_TO_BYTES(ti_width * i + span.unscrx[i], ti_size);
+    length = (span.lx[i] - span.unscrx[i] + 1) & 0xfff;
+    nq = (length + spanadvance - 1) / spanadvance;
+
+    sst = (SIGN16(t >> 16) - (tl << 3)) >> 5;
+    tbase = ((tile[tilenum].line * sst) & 0x1ff) + tile[tilenum].tmem;
+    oddrow = sst & 1;
+
+#ifdef USE_SSE
+    mask = _mm_load_si128((__m128i*) (rgba32 ? splitmasks[oddrow] : dswapmasks[oddrow]));
+#endif
+
+    for (q = 0; q < nq; q += n)
+    {
+      ss = ((s >> 16) + q * dsinc) & 0xffff;
+      sss = (SIGN16(ss) - (sl << 3)) >> 5;
+      sshorts = (ti_size == PIXEL_SIZE_8BIT) ? (sss >> 1) : sss;
+
+      n = (((ss < 0x8000) ? 0x8000 : 0x18000) - ss + dsinc - 1) / dsinc;
+      if (n > nq - q)
+        n = nq - q;
+
+      if (!rgba32)
+      {
+        assert(!(sshorts & 3));
+
+        for (run = n; run > 0; run -= count)
+        {
+          uint32_t qw = (tbase + (sshorts >> 2)) & 0x1ff;
+          count = (0x200 - qw < (uint32_t) run) ? 0x200 - qw : (uint32_t) run;
+          sshorts += count << 2;
+
+#ifdef USE_SSE
+          uint8_t* tmemptr = TMEM + (qw << 3);
+          uint32_t k;
+
+          for (k = 0; k + 1 < count; k += 2, tiptr += 16, tmemptr += 16)
+          {
+            data = _mm_loadu_si128((__m128i*) (rdram_8 + tiptr));
+            data = _mm_shuffle_epi8(data, mask);
+            _mm_storeu_si128((__m128i*) tmemptr, data);
+          }
+
+          if (k < count)
+          {
+            data = _mm_loadl_epi64((__m128i*) (rdram_8 + tiptr));
+            data = _mm_shuffle_epi8(data, mask);
+            _mm_storel_epi64((__m128i*) tmemptr, data);
+            tiptr += 8;
+          }
+#else
+          uint32_t k, idx;
+
+          for (k = 0; k < count; k++, qw++, tiptr += 8)
+          {
+            loadqword = rdram_read_qword(tiptr);
+            idx = qw << 2;
+
+            if (oddrow)
+              loadqword = (loadqword << 32) | (loadqword >> 32);
+
+            tmem16[(idx + 0) ^ WORD_ADDR_XOR] = (uint16_t)(loadqword >> 48);
+            tmem16[(idx + 1) ^ WORD_ADDR_XOR] = (uint16_t)(loadqword >> 32);
+            tmem16[(idx + 2) ^ WORD_ADDR_XOR] = (uint16_t)(loadqword >> 16);
+            tmem16[(idx + 3) ^ WORD_ADDR_XOR] = (uint16_t)(loadqword & 0xffff);
+          }
+#endif
+        }
+      }
+
+      else
+      {
+        assert(!(sshorts & 1));
+
+        for (run = n; run > 0; run--, sshorts += 2, tiptr += 8)
+        {
+          uint32_t idx = ((tbase << 2) + sshorts) & 0x3fc;
+
+#ifdef USE_SSE
+          if (!(sshorts & 2) && run > 1)
+          {
+            data = _mm_loadu_si128((__m128i*) (rdram_8 + tiptr));
+            data = _mm_shuffle_epi8(data, mask);
+            _mm_storel_epi64((__m128i*) (TMEM + (idx << 1)), data);
+            _mm_storel_epi64((__m128i*) (TMEM + ((idx | 0x400) << 1)),
+              _mm_unpackhi_epi64(data, data));
+
+            run--;
+            sshorts += 2;
+            tiptr += 8;
+            continue;
+          }
+#endif
+
+          loadqword = rdram_read_qword(tiptr);
+          readval0 = (uint32_t)(((loadqword >> 48) << 16) | ((loadqword >> 16) & 0xffff));
+          readval1 = (uint32_t)((((loadqword >> 32) & 0xffff) << 16) | (loadqword & 0xffff));
+
+          if (((sshorts >> 1) & 1) ^ oddrow)
+            idx += 2;
+
+          tmem16[idx ^ WORD_ADDR_XOR] = (uint16_t)(readval0 >> 16);
+          tmem16[(idx + 1) ^ WORD_ADDR_XOR] = (uint16_t)(readval0 & 0xffff);
+          tmem16[(idx | 0x400) ^ WORD_ADDR_XOR] = (uint16_t)(readval1 >> 16);
+          tmem16[((idx + 1) | 0x400) ^ WORD_ADDR_XOR] = (uint16_t)(readval1 & 0xffff);
+        }
+      }
+    }
+  }
+}
+
+enum EdgeWalkerType {
+  EW_R,
+  EW_G,
+  EW_B,
+  EW_A,
+  EW_S,
+  EW_T,
+  EW_W,
+  EW_Z,
+};
+
 enum EdgeWalkerDeType {
   EWDE_DRDE,
   EWDE_DGDE,
@@ -5043,6 +6106,101 @@ enum EdgeWalkerDyhType {
   EWDYH_DZDYH,
 };
 
+#ifdef USE_SSE
+#define EW_SELECT(m, a, b) _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b))
+
+/*
+ * Scissors one edge at four sub-scanlines at once. Returns the clipped
+ * 13-bit x of each lane; *under gets the lanes clamped to xh and *inside
+ * the lanes left below xl.
+ */
+static forceinline __m128i edgewalk_clip(__m128i x, __m128i clipxh, __m128i clipxl, __m128i* under, __m128i* inside)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i m1fff = _mm_set1_epi32(0x1fff);
+  __m128i m2000 = _mm_set1_epi32(0x2000);
+  __m128i m8000000 = _mm_set1_epi32(0x8000000);
+  __m128i hi = _mm_srli_epi32(x, 13);
+  __m128i sticky, sc;
+
+  sticky = _mm_cmpgt_epi32(_mm_and_si128(_mm_srli_epi32(x, 1), m1fff), zero);
+  sticky = _mm_srli_epi32(sticky, 31);
+  sc = _mm_or_si128(_mm_and_si128(hi, _mm_set1_epi32(0x1ffe)), sticky);
+  *under = _mm_or_si128(_mm_cmpeq_epi32(_mm_and_si128(x, m8000000), m8000000), _mm_cmplt_epi32(sc, clipxh));
+  sc = EW_SELECT(*under, clipxh, _mm_or_si128(_mm_and_si128(hi, _mm_set1_epi32(0x3ffe)), sticky));
+  *inside = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(sc, m2000), m2000), _mm_cmplt_epi32(_mm_and_si128(sc, m1fff), clipxl));
+  return _mm_and_si128(EW_SELECT(*inside, sc, clipxl), m1fff);
+}
+
+/*
+ * The scissoring half of the edge walker for all four sub-scanlines of
+ * span row k >> 2, one per lane; xleft and xright are the edges at
+ * sub-scanline k. Fills in majorx, minorx, invalyscan, lx and rx and
+ * returns whether any sub-scanline is left to draw. Rows where ym switches
+ * the minor edge stay on the scalar walker.
+ */
+static int edgewalk_row(int k, int flip, int32_t xleft, int32_t xleft_inc, int32_t xright, int32_t xright_inc,
+                        int32_t yhlimit, int32_t yllimit, int32_t clipxhshift, int32_t clipxlshift)
+{
+  __m128i step = _mm_setr_epi32(0, 1, 2, 3);
+  __m128i clipxh = _mm_set1_epi32(clipxhshift);
+  __m128i clipxl = _mm_set1_epi32(clipxlshift);
+  __m128i crossmask = _mm_set1_epi32(0x3fff << 14);
+  __m128i bit27 = _mm_set1_epi32(1 << 27);
+  __m128i mfff = _mm_set1_epi32(0xfff);
+  __m128i xl, xr, ky, lsc, rsc, lunder, runder, linside, rinside;
+  __m128i lcross, rcross, invaly, lv, rv;
+  int j = k >> 2;
+
+  xl = _mm_add_epi32(_mm_set1_epi32(xleft), _mm_setr_epi32(0, xleft_inc, xleft_inc * 2, xleft_inc * 3));
+  xr = _mm_add_epi32(_mm_set1_epi32(xright), _mm_setr_epi32(0, xright_inc, xright_inc * 2, xright_inc * 3));
+  ky = _mm_add_epi32(_mm_set1_epi32(k), step);
+
+  rsc = edgewalk_clip(xr, clipxh, clipxl, &runder, &rinside);
+  lsc = edgewalk_clip(xl, clipxh, clipxl, &lunder, &linside);
+  _mm_store_si128((__m128i*) span.majorx[j], rsc);
+  _mm_store_si128((__m128i*) span.minorx[j], lsc);
+
+  invaly = _mm_cmplt_epi32(ky, _mm_set1_epi32(yhlimit));
+  invaly = _mm_or_si128(invaly, _mm_xor_si128(_mm_cmplt_epi32(ky, _mm_set1_epi32(yllimit)), _mm_set1_epi32(-1)));
+  lcross = _mm_and_si128(_mm_xor_si128(xl, bit27), crossmask);
+  rcross = _mm_and_si128(_mm_xor_si128(xr, bit27), crossmask);
+  invaly = _mm_or_si128(invaly, flip ? _mm_cmplt_epi32(lcross, rcross) : _mm_cmplt_epi32(rcross, lcross));
+  _mm_store_si128((__m128i*) span.invalyscan[j], _mm_srli_epi32(invaly, 31));
+
+  /* lx and rx are the innermost edges over the valid sub-scanlines. They
+     fit in 12 bits, so the 16-bit min and max do. */
+  lv = _mm_and_si128(_mm_srli_epi32(lsc, 3), mfff);
+  rv = _mm_and_si128(_mm_srli_epi32(rsc, 3), mfff);
+  if (flip)
+  {
+    lv = _mm_andnot_si128(invaly, lv);
+    rv = EW_SELECT(invaly, mfff, rv);
+    lv = _mm_max_epi16(lv, _mm_shuffle_epi32(lv, 0x4e));
+    lv = _mm_max_epi16(lv, _mm_shuffle_epi32(lv, 0xb1));
+    rv = _mm_min_epi16(rv, _mm_shuffle_epi32(rv, 0x4e));
+    rv = _mm_min_epi16(rv, _mm_shuffle_epi32(rv, 0xb1));
+  }
+  else
+  {
+    lv = EW_SELECT(invaly, mfff, lv);
+    rv = _mm_andnot_si128(invaly, rv);
+    lv = _mm_min_epi16(lv, _mm_shuffle_epi32(lv, 0x4e));
+    lv = _mm_min_epi16(lv, _mm_shuffle_epi32(lv, 0xb1));
+    rv = _mm_max_epi16(rv, _mm_shuffle_epi32(rv, 0x4e));
+    rv = _mm_max_epi16(rv, _mm_shuffle_epi32(rv, 0xb1));
+  }
+  span.lx[j] = _mm_cvtsi128_si32(lv);
+  span.rx[j] = _mm_cvtsi128_si32(rv);
+
+  return _mm_movemask_ps(_mm_castsi128_ps(invaly)) != 0xf
+    && _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(linside, rinside)))
+    && _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(lunder, runder))) != 0xf;
+}
+
+#undef EW_SELECT
+#endif
+
 static void edgewalker_for_prims(const int32_t* ewdata)
 {
   int j = 0;
@@ -5158,14 +6316,14 @@ static void edgewalker_for_prims(const int32_t* ewdata)
 
 #define ADJUST_ATTR_PRIM()    \
 {             \
-  span[j].s = ((ewvars[EW_S] & ~0x1ff) + diffvars[EWDIFF_DSDIFF] - (xfrac * ewdxhvars[EWDXH_DSDXH])) & ~0x3ff;       \
-  span[j].t = ((ewvars[EW_T] & ~0x1ff) + diffvars[EWDIFF_DTDIFF] - (xfrac * ewdxhvars[EWDXH_DTDXH])) & ~0x3ff;       \
-  span[j].w = ((ewvars[EW_W] & ~0x1ff) + diffvars[EWDIFF_DWDIFF] - (xfrac * ewdxhvars[EWDXH_DWDXH])) & ~0x3ff;       \
-  span[j].r = ((ewvars[EW_R] & ~0x1ff) + diffvars[EWDIFF_DRDIFF] - (xfrac * ewdxhvars[EWDXH_DRDXH])) & ~0x3ff;       \
-  span[j].g = ((ewvars[EW_G] & ~0x1ff) + diffvars[EWDIFF_DGDIFF] - (xfrac * ewdxhvars[EWDXH_DGDXH])) & ~0x3ff;       \
-  span[j].b = ((ewvars[EW_B] & ~0x1ff) + diffvars[EWDIFF_DBDIFF] - (xfrac * ewdxhvars[EWDXH_DBDXH])) & ~0x3ff;       \
-  span[j].a = ((ewvars[EW_A] & ~0x1ff) + diffvars[EWDIFF_DADIFF] - (xfrac * ewdxhvars[EWDXH_DADXH])) & ~0x3ff;       \
-  span[j].z = ((ewvars[EW_Z] & ~0x1ff) + diffvars[EWDIFF_DZDIFF] - (xfrac * ewdxhvars[EWDXH_DZDXH])) & ~0x3ff;       \
+  span.s[j] = ((ewvars[EW_S] & ~0x1ff) + diffvars[EWDIFF_DSDIFF] - (xfrac * ewdxhvars[EWDXH_DSDXH])) & ~0x3ff;       \
+  span.t[j] = ((ewvars[EW_T] & ~0x1ff) + diffvars[EWDIFF_DTDIFF] - (xfrac * ewdxhvars[EWDXH_DTDXH])) & ~0x3ff;       \
+  span.w[j] = ((ewvars[EW_W] & ~0x1ff) + diffvars[EWDIFF_DWDIFF] - (xfrac * ewdxhvars[EWDXH_DWDXH])) & ~0x3ff;       \
+  span.r[j] = ((ewvars[EW_R] & ~0x1ff) + diffvars[EWDIFF_DRDIFF] - (xfrac * ewdxhvars[EWDXH_DRDXH])) & ~0x3ff;       \
+  span.g[j] = ((ewvars[EW_G] & ~0x1ff) + diffvars[EWDIFF_DGDIFF] - (xfrac * ewdxhvars[EWDXH_DGDXH])) & ~0x3ff;       \
+  span.b[j] = ((ewvars[EW_B] & ~0x1ff) + diffvars[EWDIFF_DBDIFF] - (xfrac * ewdxhvars[EWDXH_DBDXH])) & ~0x3ff;       \
+  span.a[j] = ((ewvars[EW_A] & ~0x1ff) + diffvars[EWDIFF_DADIFF] - (xfrac * ewdxhvars[EWDXH_DADXH])) & ~0x3ff;       \
+  span.z[j] = ((ewvars[EW_Z] & ~0x1ff) + diffvars[EWDIFF_DZDIFF] - (xfrac * ewdxhvars[EWDXH_DZDXH])) & ~0x3ff;       \
 }
 
   int32_t maxxmx, minxmx, maxxhx, minxhx;
@@ -5188,7 +6346,7 @@ static void edgewalker_for_prims(const int32_t* ewdata)
   if ((yl >> 2) > (ylfar >> 2))
     ylfar += 4;
   else if ((yllimit >> 2) >= 0 && (yllimit >> 2) < 1023)
-    span[(yllimit >> 2) + 1].validline = 0;
+    span.validline[(yllimit >> 2) + 1] = 0;
   
   
   if (yh & 0x2000)
@@ -5220,7 +6378,25 @@ static void edgewalker_for_prims(const int32_t* ewdata)
       xleft = xl & ~1;
       xleft_inc = (dxldy >> 2) & ~1;
     }
-    
+
+#ifdef USE_SSE
+    /* Whole span rows that ym does not split are walked four sub-scanlines at a time. */
+    if (!(k & 3) && k >= yhclose && (ym <= k || ym > k + 3))
+    {
+      j = k >> 2;
+      span.validline[j] = edgewalk_row(k, 1, xleft, xleft_inc, xright, xright_inc, yhlimit, yllimit, clipxhshift, clipxlshift)
+        && (!scfield || (scfield && !(sckeepodd ^ (j & 1))));
+      span.unscrx[j] = (xright + ldflag * xright_inc) >> 16;
+      xfrac = ((xright + ldflag * xright_inc) >> 8) & 0xff;
+      ADJUST_ATTR_PRIM();
+      AddVectors(ewvars, ewvars, ewdevars);
+      xleft += xleft_inc * 4;
+      xright += xright_inc * 4;
+      k += 3;
+      continue;
+    }
+#endif
+
     spix = k & 3;
             
     if (k >= yhclose)
@@ -5243,7 +6419,7 @@ static void edgewalker_for_prims(const int32_t* ewdata)
       xrsc = curunder ? clipxhshift : (((xright >> 13) & 0x3ffe) | stickybit);
       curover = ((xrsc & 0x2000) || (xrsc & 0x1fff) >= clipxlshift);
       xrsc = curover ? clipxlshift : xrsc;
-      span[j].majorx[spix] = xrsc & 0x1fff;
+      span.majorx[j][spix] = xrsc & 0x1fff;
       allover &= curover;
       allunder &= curunder; 
 
@@ -5253,7 +6429,7 @@ static void edgewalker_for_prims(const int32_t* ewdata)
       xlsc = curunder ? clipxhshift : (((xleft >> 13) & 0x3ffe) | stickybit);
       curover = ((xlsc & 0x2000) || (xlsc & 0x1fff) >= clipxlshift);
       xlsc = curover ? clipxlshift : xlsc;
-      span[j].minorx[spix] = xlsc & 0x1fff;
+      span.minorx[j][spix] = xlsc & 0x1fff;
       allover &= curover;
       allunder &= curunder; 
       
@@ -5263,7 +6439,7 @@ static void edgewalker_for_prims(const int32_t* ewdata)
       
 
       invaly |= curcross;
-      span[j].invalyscan[spix] = invaly;
+      span.invalyscan[j][spix] = invaly;
       allinval &= invaly;
 
       if (!invaly)
@@ -5274,16 +6450,16 @@ static void edgewalker_for_prims(const int32_t* ewdata)
       
       if (spix == ldflag)
       {
-        span[j].unscrx = xright >> 16;
+        span.unscrx[j] = xright >> 16;
         xfrac = (xright >> 8) & 0xff;
         ADJUST_ATTR_PRIM();
       }
 
       if (spix == 3)
       {
-        span[j].lx = maxxmx;
-        span[j].rx = minxhx;
-        span[j].validline  = !allinval && !allover && !allunder && (!scfield || (scfield && !(sckeepodd ^ (j & 1))));
+        span.lx[j] = maxxmx;
+        span.rx[j] = minxhx;
+        span.validline[j]  = !allinval && !allover && !allunder && (!scfield || (scfield && !(sckeepodd ^ (j & 1))));
         
       }
       
@@ -5307,7 +6483,25 @@ static void edgewalker_for_prims(const int32_t* ewdata)
       xleft = xl & ~1;
       xleft_inc = (dxldy >> 2) & ~1;
     }
-    
+
+#ifdef USE_SSE
+    /* Whole span rows that ym does not split are walked four sub-scanlines at a time. */
+    if (!(k & 3) && k >= yhclose && (ym <= k || ym > k + 3))
+    {
+      j = k >> 2;
+      span.validline[j] = edgewalk_row(k, 0, xleft, xleft_inc, xright, xright_inc, yhlimit, yllimit, clipxhshift, clipxlshift)
+        && (!scfield || (scfield && !(sckeepodd ^ (j & 1))));
+      span.unscrx[j] = (xright + ldflag * xright_inc) >> 16;
+      xfrac = ((xright + ldflag * xright_inc) >> 8) & 0xff;
+      ADJUST_ATTR_PRIM();
+      AddVectors(ewvars, ewvars, ewdevars);
+      xleft += xleft_inc * 4;
+      xright += xright_inc * 4;
+      k += 3;
+      continue;
+    }
+#endif
+
     spix = k & 3;
             
     if (k >= yhclose)
@@ -5329,7 +6523,7 @@ static void edgewalker_for_prims(const int32_t* ewdata)
       xrsc = curunder ? clipxhshift : (((xright >> 13) & 0x3ffe) | stickybit);
       curover = ((xrsc & 0x2000) || (xrsc & 0x1fff) >= clipxlshift);
       xrsc = curover ? clipxlshift : xrsc;
-      span[j].majorx[spix] = xrsc & 0x1fff;
+      span.majorx[j][spix] = xrsc & 0x1fff;
       allover &= curover;
       allunder &= curunder; 
 
@@ -5339,14 +6533,14 @@ static void edgewalker_for_prims(const int32_t* ewdata)
       xlsc = curunder ? clipxhshift : (((xleft >> 13) & 0x3ffe) | stickybit);
       curover = ((xlsc & 0x2000) || (xlsc & 0x1fff) >= clipxlshift);
       xlsc = curover ? clipxlshift : xlsc;
-      span[j].minorx[spix] = xlsc & 0x1fff;
+      span.minorx[j][spix] = xlsc & 0x1fff;
       allover &= curover;
       allunder &= curunder; 
 
       curcross = ((xright ^ (1 << 27)) & (0x3fff << 14)) < ((xleft ^ (1 << 27)) & (0x3fff << 14));
             
       invaly |= curcross;
-      span[j].invalyscan[spix] = invaly;
+      span.invalyscan[j][spix] = invaly;
       allinval &= invaly;
 
       if (!invaly)
@@ -5357,16 +6551,16 @@ static void edgewalker_for_prims(const int32_t* ewdata)
 
       if (spix == ldflag)
       {
-        span[j].unscrx  = xright >> 16;
+        span.unscrx[j]  = xright >> 16;
         xfrac = (xright >> 8) & 0xff;
         ADJUST_ATTR_PRIM();
       }
 
       if (spix == 3)
       {
-        span[j].lx = minxmx;
-        span[j].rx = maxxhx;
-        span[j].validline  = !allinval && !allover && !allunder && (!scfield || (scfield && !(sckeepodd ^ (j & 1))));
+        span.lx[j] = minxmx;
+        span.rx[j] = maxxhx;
+        span.validline[j]  = !allinval && !allover && !allunder && (!scfield || (scfield && !(sckeepodd ^ (j & 1))));
       }
       
     }
@@ -5383,6 +6577,11 @@ static void edgewalker_for_prims(const int32_t* ewdata)
   
   
 
+  hiz_begin_primitive(yhlimit >> 2, yllimit >> 2);
+  zmirror_begin_primitive(yhlimit >> 2, yllimit >> 2);
+  dirty_mark_primitive(yhlimit >> 2, yllimit >> 2);
+  noise_next_primitive();
+
   switch(other_modes.cycle_type)
   {
     case CYCLE_TYPE_1: render_spans_1cycle_ptr(yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
@@ -5413,6 +6612,9 @@ static void edgewalker_for_loads(int32_t* lewdata)
   max_level = 0;
   tilenum = (lewdata[0] >> 16) & 7;
 
+  /* Loads read RDRAM directly. */
+  zmirror_writeback();
+
   
   yl = SIGN(lewdata[0], 14); 
   ym = lewdata[1] >> 16;
@@ -5440,8 +6642,8 @@ static void edgewalker_for_loads(int32_t* lewdata)
 
 #define ADJUST_ATTR_LOAD()                    \
 {                               \
-  span[j].s = s & ~0x3ff;                   \
-  span[j].t = t & ~0x3ff;                   \
+  span.s[j] = s & ~0x3ff;                   \
+  span.t[j] = t & ~0x3ff;                   \
 }
 
 #define ADDVALUES_LOAD() {  \
@@ -5494,14 +6696,14 @@ static void edgewalker_for_loads(int32_t* lewdata)
 
       if (spix == 0)
       {
-        span[j].unscrx = xend;
+        span.unscrx[j] = xend;
         ADJUST_ATTR_LOAD();
       }
 
       if (spix == 3)
       {
-        span[j].lx = maxxmx;
-        span[j].rx = minxhx;
+        span.lx[j] = maxxmx;
+        span.rx[j] = minxhx;
         
         
       }
@@ -5518,7 +6720,10 @@ static void edgewalker_for_loads(int32_t* lewdata)
 
   }
 
-  loading_pipeline(yhlimit >> 2, yllimit >> 2, tilenum, coord_quad, ltlut);
+  if (!coord_quad && loading_pipeline_rows_ok(tilenum))
+    loading_pipeline_rows(yhlimit >> 2, yllimit >> 2, tilenum);
+  else
+    loading_pipeline(yhlimit >> 2, yllimit >> 2, tilenum, coord_quad, ltlut);
 }
 
 static const uint32_t rdp_command_length[64] = {
@@ -5788,6 +6993,8 @@ static void rdp_sync_tile(uint32_t w1, uint32_t w2)
 static void rdp_sync_full(uint32_t w1, uint32_t w2)
 {
   z64gl_command = 0;
+  noise_next_frame();
+  zmirror_writeback();
   BusRaiseRCPInterrupt(my_rdp->bus, MI_INTR_DP);
 }
 
@@ -5816,6 +7023,19 @@ static void rdp_set_convert(uint32_t w1, uint32_t w2)
   k3 = (w2 >> 18) & 0x1ff;
   k4 = (w2 >> 9) & 0x1ff;
   k5 = w2 & 0x1ff;
+
+#ifdef USE_SSE
+  /* (newk - ~newk) coefficients, laid out as (r, g) weight pairs */
+  /* for the R, G, B and A lanes of texture_convert. */
+  convert_kvec[0] = 0;
+  convert_kvec[1] = 2 * SIGN(k0, 9) + 1;
+  convert_kvec[2] = 2 * SIGN(k1, 9) + 1;
+  convert_kvec[3] = 2 * SIGN(k2, 9) + 1;
+  convert_kvec[4] = 2 * SIGN(k3, 9) + 1;
+  convert_kvec[5] = 0;
+  convert_kvec[6] = 0;
+  convert_kvec[7] = 0;
+#endif
 }
 
 static void rdp_set_scissor(uint32_t w1, uint32_t w2)
@@ -5885,6 +7105,9 @@ static void rdp_set_other_modes(uint32_t w1, uint32_t w2)
   SET_BLENDER_INPUT(1, 1, &blender2a_r[1], &blender2a_g[1], &blender2a_b[1], &blender2b_a[1],
             other_modes.blend_m2a_1, other_modes.blend_m2b_1);
 
+  for (int i = 0; i < 8; i++)
+    calculate_tile_sampler(i);
+
   other_modes.f.stalederivs = 1;
 }
 
@@ -5932,24 +7155,62 @@ void deduce_derivatives()
     combiner_rgbmul_r[0] == &texel0_color.a)
     texel0_used_in_cc0 = 1;
   
+  other_modes.f.opaque_1cycle = !other_modes.image_read_en && !other_modes.force_blend &&
+    !other_modes.antialias_en && !other_modes.color_on_cvg && blender1a_r[0] == &pixel_color.r;
+
+  /*
+   * Early Z: the span loops may test depth before texturing and combining
+   * and skip both for rejected pixels, as long as the combiner can neither
+   * feed the Z test (cvg_times_alpha, interpenetrating coverage read back
+   * through alpha_cvg_select) nor carry combined_color into the next pixel.
+   */
+  int combined_used_in_cc1 =
+    combiner_rgbmul_r[1] == &combined_color.r || combiner_rgbsub_a_r[1] == &combined_color.r || \
+    combiner_rgbsub_b_r[1] == &combined_color.r || combiner_rgbadd_r[1] == &combined_color.r || \
+    combiner_rgbmul_r[1] == &combined_color.a || combiner_alphamul[1] == &combined_color.a || \
+    combiner_alphasub_a[1] == &combined_color.a || combiner_alphasub_b[1] == &combined_color.a || \
+    combiner_alphaadd[1] == &combined_color.a;
+  int combined_used_in_cc0 =
+    combiner_rgbmul_r[0] == &combined_color.r || combiner_rgbsub_a_r[0] == &combined_color.r || \
+    combiner_rgbsub_b_r[0] == &combined_color.r || combiner_rgbadd_r[0] == &combined_color.r || \
+    combiner_rgbmul_r[0] == &combined_color.a || combiner_alphamul[0] == &combined_color.a || \
+    combiner_alphasub_a[0] == &combined_color.a || combiner_alphasub_b[0] == &combined_color.a || \
+    combiner_alphaadd[0] == &combined_color.a;
+  int early_z = other_modes.z_compare_en && !other_modes.cvg_times_alpha &&
+    !(other_modes.z_mode == ZMODE_INTERPENETRATING && other_modes.alpha_cvg_select);
+
+  other_modes.f.early_z_1cycle = early_z && !combined_used_in_cc1;
+  other_modes.f.early_z_2cycle = early_z && !combined_used_in_cc0;
+  other_modes.f.zrun_1cycle = other_modes.f.opaque_1cycle && other_modes.f.early_z_1cycle &&
+    other_modes.z_mode == ZMODE_OPAQUE;
+
+  int spanfunc;
+
   if (texel1_used_in_cc1)
-    render_spans_1cycle_ptr = render_spans_1cycle_func[2];
+    spanfunc = 2;
   else if (texel0_used_in_cc1 || lod_frac_used_in_cc1)
-    render_spans_1cycle_ptr = render_spans_1cycle_func[1];
+    spanfunc = 1;
   else
-    render_spans_1cycle_ptr = render_spans_1cycle_func[0];
+    spanfunc = 0;
+
+  if (other_modes.f.opaque_1cycle)
+    render_spans_1cycle_ptr = span_funcs->cycle1_opaque[spanfunc];
+  else
+    render_spans_1cycle_ptr = span_funcs->cycle1[spanfunc];
 
   if (texel1_used_in_cc1)
-    render_spans_2cycle_ptr = render_spans_2cycle_func[3];
+    render_spans_2cycle_ptr = span_funcs->cycle2[3];
   else if (texel1_used_in_cc0 || texel0_used_in_cc1)
-    render_spans_2cycle_ptr = render_spans_2cycle_func[2];
+    render_spans_2cycle_ptr = span_funcs->cycle2[2];
   else if (texel0_used_in_cc0 || lod_frac_used_in_cc0 || lod_frac_used_in_cc1)
-    render_spans_2cycle_ptr = render_spans_2cycle_func[1];
+    render_spans_2cycle_ptr = span_funcs->cycle2[1];
   else
-    render_spans_2cycle_ptr = render_spans_2cycle_func[0];
+    render_spans_2cycle_ptr = span_funcs->cycle2[0];
 
   
   int lodfracused = 0;
+  const DitherNoiseFunc* noise_funcs = (noise_source == NOISE_HASHED) ?
+    DitherNoiseHashedFuncLUT : DitherNoiseFuncLUT;
 
   if ((other_modes.cycle_type == CYCLE_TYPE_2 && (lod_frac_used_in_cc0 || lod_frac_used_in_cc1)) || \
     (other_modes.cycle_type == CYCLE_TYPE_1 && lod_frac_used_in_cc1))
@@ -5958,11 +7219,13 @@ void deduce_derivatives()
   if ((other_modes.cycle_type == CYCLE_TYPE_1 && combiner_rgbsub_a_r[1] == &noise) || \
     (other_modes.cycle_type == CYCLE_TYPE_2 && (combiner_rgbsub_a_r[0] == &noise || combiner_rgbsub_a_r[1] == &noise)) || \
     other_modes.alpha_dither_sel == 2)
-    get_dither_noise_ptr = DitherNoiseFuncLUT[0];
+    get_dither_noise_ptr = noise_funcs[0];
   else if (other_modes.f.rgb_alpha_dither != 0xf)
-    get_dither_noise_ptr = DitherNoiseFuncLUT[1];
+    get_dither_noise_ptr = noise_funcs[1];
   else
-    get_dither_noise_ptr = DitherNoiseFuncLUT[2];
+    get_dither_noise_ptr = noise_funcs[2];
+  other_modes.f.noise_draws = (get_dither_noise_ptr == noise_funcs[0]) +
+    ((other_modes.f.rgb_alpha_dither & 0xc) == 8);
 
   other_modes.f.dolod = other_modes.tex_lod_en || lodfracused;
 }
@@ -6207,7 +7470,8 @@ static void rdp_set_color_image(uint32_t w1, uint32_t w2)
   fbread1_ptr = FBReadFuncLUT[fb_size];
   fbread2_ptr = FBReadFunc2LUT[fb_size];
   fbwrite_ptr = FBWriteFuncLUT[fb_size];
-  fbfill_ptr = fbfill_func[fb_size];
+  fbwrite_run_ptr = FBWriteRunFuncLUT[fb_size];
+  dirty_cur = NULL;
 }
 
 static void (*const rdp_command_table[64])(uint32_t w1, uint32_t w2) = {
@@ -6304,6 +7568,7 @@ static int alpha_compare(int32_t comb_alpha)
   }
 }
 
+#ifndef USE_SSE
 static int32_t color_combiner_equation(int32_t a, int32_t b, int32_t c, int32_t d)
 {
 
@@ -6324,40 +7589,107 @@ static int32_t alpha_combiner_equation(int32_t a, int32_t b, int32_t c, int32_t
   a = (((a - b) * c) + (d << 8) + 0x80) >> 8;
   return (a & 0x1ff);
 }
+#endif
+
+#ifdef USE_SSE
+/*
+ * Forms 1a * blend1a + 2a * mulb for R, G and B in one pmaddwd: each lane
+ * holds the (1a, 2a) colour pair against the shared (blend1a, mulb) pair.
+ */
+static __m128i blender_products(int cycle, int blend1a, int mulb)
+{
+  __m128i a, b;
+
+  a = _mm_setr_epi32(*blender1a_r[cycle], *blender1a_g[cycle], *blender1a_b[cycle], 0);
+  b = _mm_setr_epi32(*blender2a_r[cycle], *blender2a_g[cycle], *blender2a_b[cycle], 0);
+  return _mm_madd_epi16(_mm_or_si128(a, _mm_slli_epi32(b, 16)),
+    _mm_set1_epi32((mulb << 16) | blend1a));
+}
+
+static void blender_store(int* r, int* g, int* b, __m128i rgb)
+{
+  int32_t out[4] align(16);
+
+  _mm_store_si128((__m128i*) out, rgb);
+  *r = out[0];
+  *g = out[1];
+  *b = out[2];
+}
+
+/*
+ * Hardware blender division of each lane by the blend weight sum.
+ *
+ * By default the three quotients come from bldiv_hwaccurate_table, with
+ * the indices formed in the vector. Building with -DBLDIV_ARITHMETIC
+ * instead runs the 8-step non-restoring divider the table was generated
+ * from on all lanes at once; the results are identical and the 32KB
+ * table stays out of the cache.
+ */
+static void blender_divide(int* r, int* g, int* b, __m128i bl, int blend1a, int blend2a)
+{
+  int32_t sum = ((blend1a & ~3) + (blend2a & ~3) + 4) << 9;
+  __m128i n = _mm_and_si128(_mm_srai_epi32(bl, 2), _mm_set1_epi32(0x7ff));
+
+#ifndef BLDIV_ARITHMETIC
+  int32_t idx[4] align(16);
+
+  _mm_store_si128((__m128i*) idx, _mm_or_si128(n, _mm_set1_epi32(sum)));
+  *r = bldiv_hwaccurate_table[idx[0]];
+  *g = bldiv_hwaccurate_table[idx[1]];
+  *b = bldiv_hwaccurate_table[idx[2]];
+#else
+  int32_t d = (sum >> 11) & 0xf, invd = ~d & 0xf;
+  __m128i seven = _mm_set1_epi32(7), one = _mm_set1_epi32(1);
+  __m128i vd = _mm_set1_epi32(d), vinvd = _mm_set1_epi32(invd + 1 - d);
+  __m128i ps, temp, bit, res = _mm_setzero_si128(), prev = _mm_setzero_si128();
+  int k;
+
+  ps = _mm_and_si128(_mm_add_epi32(_mm_srli_epi32(n, 8), _mm_set1_epi32(invd + 1)), seven);
+
+  for (k = 0; k < 8; k++)
+  {
+    temp = _mm_add_epi32(_mm_slli_epi32(ps, 1), _mm_and_si128(_mm_srl_epi32(n, _mm_cvtsi32_si128(7 - k)), one));
+    temp = _mm_add_epi32(temp, _mm_add_epi32(vd, _mm_and_si128(prev, vinvd)));
+    ps = _mm_and_si128(temp, seven);
+    bit = _mm_and_si128(_mm_srli_epi32(temp, 4), one);
+    res = _mm_or_si128(_mm_slli_epi32(res, 1), bit);
+    prev = _mm_sub_epi32(_mm_setzero_si128(), bit);
+  }
+
+  blender_store(r, g, b, res);
+#endif
+}
+#endif
 
 static void blender_equation_cycle0(int* r, int* g, int* b)
 {
   int blend1a, blend2a;
-  int blr, blg, blb, sum;
   blend1a = *blender1b_a[0] >> 3;
   blend2a = *blender2b_a[0] >> 3;
 
-  int mulb;
-    
-  
-  
   if (other_modes.f.special_bsel0)
   {
     blend1a = (blend1a >> blshifta) & 0x3C;
     blend2a = (blend2a >> blshiftb) | 3;
   }
-  
-  mulb = blend2a + 1;
 
-  
+#ifdef USE_SSE
+  __m128i bl = blender_products(0, blend1a, blend2a + 1);
+
+  if (!other_modes.force_blend)
+    blender_divide(r, g, b, bl, blend1a, blend2a);
+  else
+    blender_store(r, g, b, _mm_and_si128(_mm_srai_epi32(bl, 5), _mm_set1_epi32(0xff)));
+#else
+  int blr, blg, blb, sum;
+  int mulb = blend2a + 1;
+
   blr = (*blender1a_r[0]) * blend1a + (*blender2a_r[0]) * mulb;
   blg = (*blender1a_g[0]) * blend1a + (*blender2a_g[0]) * mulb;
   blb = (*blender1a_b[0]) * blend1a + (*blender2a_b[0]) * mulb;
-  
-  
 
   if (!other_modes.force_blend)
   {
-    
-    
-    
-    
-    
     sum = ((blend1a & ~3) + (blend2a & ~3) + 4) << 9;
     *r = bldiv_hwaccurate_table[sum | ((blr >> 2) & 0x7ff)];
     *g = bldiv_hwaccurate_table[sum | ((blg >> 2) & 0x7ff)];
@@ -6369,6 +7701,7 @@ static void blender_equation_cycle0(int* r, int* g, int* b)
     *g = (blg >> 5) & 0xff; 
     *b = (blb >> 5) & 0xff;
   } 
+#endif
 }
 
 static void blender_equation_cycle0_2(int* r, int* g, int* b)
@@ -6384,26 +7717,39 @@ static void blender_equation_cycle0_2(int* r, int* g, int* b)
   }
   
   blend2a += 1;
+#ifdef USE_SSE
+  blender_store(r, g, b, _mm_and_si128(_mm_srai_epi32(
+    blender_products(0, blend1a, blend2a), 5), _mm_set1_epi32(0xff)));
+#else
   *r = (((*blender1a_r[0]) * blend1a + (*blender2a_r[0]) * blend2a) >> 5) & 0xff;
   *g = (((*blender1a_g[0]) * blend1a + (*blender2a_g[0]) * blend2a) >> 5) & 0xff;
   *b = (((*blender1a_b[0]) * blend1a + (*blender2a_b[0]) * blend2a) >> 5) & 0xff;
+#endif
 }
 
 static void blender_equation_cycle1(int* r, int* g, int* b)
 {
   int blend1a, blend2a;
-  int blr, blg, blb, sum;
   blend1a = *blender1b_a[1] >> 3;
   blend2a = *blender2b_a[1] >> 3;
 
-  int mulb;
   if (other_modes.f.special_bsel1)
   {
     blend1a = (blend1a >> blshifta) & 0x3C;
     blend2a = (blend2a >> blshiftb) | 3;
   }
-  
-  mulb = blend2a + 1;
+
+#ifdef USE_SSE
+  __m128i bl = blender_products(1, blend1a, blend2a + 1);
+
+  if (!other_modes.force_blend)
+    blender_divide(r, g, b, bl, blend1a, blend2a);
+  else
+    blender_store(r, g, b, _mm_and_si128(_mm_srai_epi32(bl, 5), _mm_set1_epi32(0xff)));
+#else
+  int blr, blg, blb, sum;
+  int mulb = blend2a + 1;
+
   blr = (*blender1a_r[1]) * blend1a + (*blender2a_r[1]) * mulb;
   blg = (*blender1a_g[1]) * blend1a + (*blender2a_g[1]) * mulb;
   blb = (*blender1a_b[1]) * blend1a + (*blender2a_b[1]) * mulb;
@@ -6421,6 +7767,7 @@ static void blender_equation_cycle1(int* r, int* g, int* b)
     *g = (blg >> 5) & 0xff; 
     *b = (blb >> 5) & 0xff;
   }
+#endif
 }
 
 static uint32_t rightcvghex(uint32_t x, uint32_t fmask)
@@ -6440,129 +7787,197 @@ static uint32_t leftcvghex(uint32_t x, uint32_t fmask)
 
 static void compute_cvg_flip(int32_t scanline)
 {
-  int32_t purgestart, purgeend;
-  int i, length, fmask, maskshift, fmaskshifted;
-  int32_t fleft, minorcur, majorcur, minorcurint, majorcurint, samecvg;
+  int32_t lo[4], hi[4];
+  uint32_t vlo[4], vhi[4], vin[4];
+  int32_t purgestart, length, minorcur, majorcur;
+  int i;
   
-  purgestart = span[scanline].rx;
-  purgeend = span[scanline].lx;
-  length = purgeend - purgestart;
-  if (length >= 0)
-  {
-    memset(&cvgbuf[purgestart], 0, (length + 1) << 2);
-    for(i = 0; i < 4; i++)
-    {
-      if (!span[scanline].invalyscan[i])
-      {
-        minorcur = span[scanline].minorx[i];
-        majorcur = span[scanline].majorx[i];
-        minorcurint = minorcur >> 3;
-        majorcurint = majorcur >> 3;
-        fmask = 0xa >> (i & 1);
-        
-        
-        
-        
-        maskshift = (i - 2) & 4;
-
-        fmaskshifted = fmask << maskshift;
-        fleft = majorcurint + 1;
+  purgestart = span.rx[scanline];
+  length = span.lx[scanline] - purgestart;
+  if (length < 0)
+    return;
 
-        if (minorcurint != majorcurint)
-        {
-          cvgbuf[minorcurint] |= (rightcvghex(minorcur, fmask) << maskshift);
-          cvgbuf[majorcurint] |= (leftcvghex(majorcur, fmask) << maskshift);
-        }
-        else
-        {
-          samecvg = rightcvghex(minorcur, fmask) & leftcvghex(majorcur, fmask);
-          cvgbuf[majorcurint] |= (samecvg << maskshift);
-        }
-        for (; fleft < minorcurint; fleft++)
-          cvgbuf[fleft] |= fmaskshifted;
-      }
-    }
+  for (i = 0; i < 4; i++)
+  {
+    minorcur = span.minorx[scanline][i];
+    majorcur = span.majorx[scanline][i];
+    lo[i] = majorcur >> 3;
+    hi[i] = minorcur >> 3;
+    vlo[i] = leftcvghex(majorcur, 0xa >> (i & 1));
+    vhi[i] = rightcvghex(minorcur, 0xa >> (i & 1));
   }
+  compute_cvg_row(scanline, purgestart, length, lo, hi, vlo, vhi, vin);
 }
 
 static void compute_cvg_noflip(int32_t scanline)
 {
-  int32_t purgestart, purgeend;
-  int i, length, fmask, maskshift, fmaskshifted;
-  int32_t fleft, minorcur, majorcur, minorcurint, majorcurint, samecvg;
+  int32_t lo[4], hi[4];
+  uint32_t vlo[4], vhi[4], vin[4];
+  int32_t purgestart, length, minorcur, majorcur;
+  int i;
   
-  purgestart = span[scanline].lx;
-  purgeend = span[scanline].rx;
-  length = purgeend - purgestart;
+  purgestart = span.lx[scanline];
+  length = span.rx[scanline] - purgestart;
+  if (length < 0)
+    return;
 
-  if (length >= 0)
+  for (i = 0; i < 4; i++)
   {
-    memset(&cvgbuf[purgestart], 0, (length + 1) << 2);
+    minorcur = span.minorx[scanline][i];
+    majorcur = span.majorx[scanline][i];
+    lo[i] = minorcur >> 3;
+    hi[i] = majorcur >> 3;
+    vlo[i] = leftcvghex(minorcur, 0xa >> (i & 1));
+    vhi[i] = rightcvghex(majorcur, 0xa >> (i & 1));
+  }
+  compute_cvg_row(scanline, purgestart, length, lo, hi, vlo, vhi, vin);
+}
+
+/* Builds cvgbuf[start..start+length] in one pass. Sub-scanline i covers the
+   pixels strictly between lo[i] and hi[i] fully and the pixels at lo[i] and
+   hi[i] partially; all four are merged per pixel rather than ORed in one
+   sub-scanline at a time. Pixels inside every sub-scanline are fully covered
+   and are recorded in cvgfull_start/cvgfull_length for lookup_span_cvg. */
+static void compute_cvg_row(int32_t scanline, int32_t start, int32_t length, int32_t* lo, int32_t* hi, uint32_t* vlo, uint32_t* vhi, uint32_t* vin)
+{
+  int32_t end, fullstart, fullend;
+  int i, allvalid = 1;
 
-    for(i = 0; i < 4; i++)
+  fullstart = start;
+  fullend = start + length;
+  for (i = 0; i < 4; i++)
+  {
+    if (span.invalyscan[scanline][i])
+    {
+      lo[i] = hi[i] = -1;
+      vlo[i] = vhi[i] = vin[i] = 0;
+      allvalid = 0;
+    }
+    else
     {
-      if (!span[scanline].invalyscan[i])
+      vin[i] = 0xa >> (i & 1);
+      if (lo[i] == hi[i])
       {
-        minorcur = span[scanline].minorx[i];
-        majorcur = span[scanline].majorx[i];
-        minorcurint = minorcur >> 3;
-        majorcurint = majorcur >> 3;
-        fmask = 0xa >> (i & 1);
-        maskshift = (i - 2) & 4;
-        fmaskshifted = fmask << maskshift;
-        fleft = minorcurint + 1;
-
-        if (minorcurint != majorcurint)
-        {
-          cvgbuf[minorcurint] |= (leftcvghex(minorcur, fmask) << maskshift);
-          cvgbuf[majorcurint] |= (rightcvghex(majorcur, fmask) << maskshift);
-        }
-        else
-        {
-          samecvg = leftcvghex(minorcur, fmask) & rightcvghex(majorcur, fmask);
-          cvgbuf[majorcurint] |= (samecvg << maskshift);
-        }
-        for (; fleft < majorcurint; fleft++)
-          cvgbuf[fleft] |= fmaskshifted;
+        vlo[i] &= vhi[i];
+        vhi[i] = 0;
+      }
+      if (lo[i] < hi[i])
+      {
+        fullstart = (lo[i] + 1 > fullstart) ? lo[i] + 1 : fullstart;
+        fullend = (hi[i] - 1 < fullend) ? hi[i] - 1 : fullend;
       }
+      else
+        allvalid = 0;
     }
+    if (i < 2)
+    {
+      vlo[i] <<= 4;
+      vhi[i] <<= 4;
+      vin[i] <<= 4;
+    }
+  }
+
+  end = start + length + 1;
+  if (allvalid && fullstart <= fullend)
+  {
+    cvgfull_start = fullstart;
+    cvgfull_length = fullend - fullstart + 1;
+    compute_cvg_segment(start, fullstart, lo, hi, vlo, vhi, vin);
+    memset(&cvgbuf[fullstart], 0xff, cvgfull_length);
+    compute_cvg_segment(fullend + 1, end, lo, hi, vlo, vhi, vin);
+  }
+  else
+  {
+    cvgfull_length = 0;
+    compute_cvg_segment(start, end, lo, hi, vlo, vhi, vin);
   }
 }
 
-int rdp_close()
+static void compute_cvg_segment(int32_t x, int32_t end, const int32_t* lo, const int32_t* hi, const uint32_t* vlo, const uint32_t* vhi, const uint32_t* vin)
 {
-  return 0;
-}
+  uint32_t v;
+  int i;
 
-static void fbfill_4(uint32_t curpixel) {
-  debug("fbfill_4: Pipeline crashed.");
+#ifdef USE_SSE
+  {
+    __m128i xv, acc, lov, hiv, inside, edge;
+    
+    xv = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+    xv = _mm_add_epi16(xv, _mm_set1_epi16((int16_t)x));
+    for (; x + 8 <= end; x += 8)
+    {
+      acc = _mm_setzero_si128();
+      for (i = 0; i < 4; i++)
+      {
+        lov = _mm_set1_epi16((int16_t)lo[i]);
+        hiv = _mm_set1_epi16((int16_t)hi[i]);
+        inside = _mm_and_si128(_mm_cmpgt_epi16(xv, lov), _mm_cmpgt_epi16(hiv, xv));
+        acc = _mm_or_si128(acc, _mm_and_si128(inside, _mm_set1_epi16((int16_t)vin[i])));
+        edge = _mm_and_si128(_mm_cmpeq_epi16(xv, lov), _mm_set1_epi16((int16_t)vlo[i]));
+        acc = _mm_or_si128(acc, edge);
+        edge = _mm_and_si128(_mm_cmpeq_epi16(xv, hiv), _mm_set1_epi16((int16_t)vhi[i]));
+        acc = _mm_or_si128(acc, edge);
+      }
+      _mm_storel_epi64((__m128i*)&cvgbuf[x], _mm_packus_epi16(acc, acc));
+      xv = _mm_add_epi16(xv, _mm_set1_epi16(8));
+    }
+  }
+#endif
+  for (; x < end; x++)
+  {
+    v = 0;
+    for (i = 0; i < 4; i++)
+    {
+      v |= (x > lo[i] && x < hi[i]) ? vin[i] : 0;
+      v |= (x == lo[i]) ? vlo[i] : 0;
+      v |= (x == hi[i]) ? vhi[i] : 0;
+    }
+    cvgbuf[x] = v;
+  }
 }
 
-static void fbfill_8(uint32_t curpixel)
+int rdp_close()
 {
-  uint32_t fb = fb_address + curpixel;
-  uint32_t val = (fill_color >> (((fb & 3) ^ 3) << 3)) & 0xff;
-  uint8_t hval = ((val & 1) << 1) | (val & 1);
-  PAIRWRITE8(fb, val, hval);
+  return 0;
 }
 
-static void fbfill_16(uint32_t curpixel)
+/*
+ * Whatever the pixel size, fill mode leaves RDRAM holding fill_color as a
+ * repeating big-endian word, and sets each hidden bit from bit 16 or bit 0
+ * of it by the parity of its halfword (8-bit fills only write the hidden
+ * bit of odd bytes, which works out the same). A run of filled pixels is
+ * therefore a pattern fill of the bytes [start, end).
+ */
+static void fbfill_bytes(uint32_t start, uint32_t end)
 {
-  uint16_t val;
-  uint8_t hval;
-  uint32_t fb = (fb_address >> 1) + curpixel;
-  if (fb & 1)
-    val = fill_color & 0xffff;
-  else
-    val = (fill_color >> 16) & 0xffff;
-  hval = ((val & 1) << 1) | (val & 1);
-  PAIRWRITE16(fb, val, hval);
-}
+  uint32_t pattern = bswap32(fill_color);
+  uint8_t hval[2];
+  uint32_t a = start, h;
 
-static void fbfill_32(uint32_t curpixel)
-{
-  uint32_t fb = (fb_address >> 2) + curpixel;
-  PAIRWRITE32(fb, fill_color, (fill_color & 0x10000) ? 3 : 0, (fill_color & 0x1) ? 3 : 0);
+  assert(end <= 0x800000);
+  hval[0] = (fill_color & 0x10000) ? 3 : 0;
+  hval[1] = (fill_color & 0x1) ? 3 : 0;
+
+  for (; a < end && (a & 15); a++)
+    rdram_8[a] = pattern >> ((a & 3) << 3);
+#ifdef USE_SSE
+  __m128i fill = _mm_set1_epi32(pattern);
+  for (; a + 16 <= end; a += 16)
+    _mm_storeu_si128((__m128i*) (rdram_8 + a), fill);
+#else
+  for (; a + 4 <= end; a += 4)
+    rdram[a >> 2] = pattern;
+#endif
+  for (; a < end; a++)
+    rdram_8[a] = pattern >> ((a & 3) << 3);
+
+  if (hval[0] == hval[1])
+    memset(&hidden_bits[start >> 1], hval[0], (end >> 1) - (start >> 1));
+  else
+  {
+    for (h = start >> 1; h < (end >> 1); h++)
+      hidden_bits[h] = hval[h & 1];
+  }
 }
 
 static uint32_t z_decompress(uint32_t zb)
@@ -6579,11 +7994,745 @@ static void lookup_cvmask_derivatives(uint32_t mask, uint8_t* offx, uint8_t* off
   *offy = temp.yoff;
 }
 
-static void z_store(uint32_t zcurpixel, uint32_t z, int dzpixenc)
+/* Fully covered pixels of the current line need no table lookup and no
+   offset correction; only the partially covered edges go through cvarray. */
+static forceinline void lookup_span_cvg(int x, uint8_t* offx, uint8_t* offy, uint32_t* curpixel_cvg, uint32_t* curpixel_cvbit)
 {
-  uint16_t zval = z_com_table[z & 0x3ffff]|(dzpixenc >> 2);
-  uint8_t hval = dzpixenc & 3;
-  PAIRWRITE16(zcurpixel, zval, hval);
+  if ((uint32_t)(x - cvgfull_start) < cvgfull_length)
+  {
+    *curpixel_cvg = 8;
+    *curpixel_cvbit = 1;
+    *offx = *offy = 0;
+  }
+  else
+    lookup_cvmask_derivatives(cvgbuf[x], offx, offy, curpixel_cvg, curpixel_cvbit);
+}
+
+static void z_store(uint32_t zcurpixel, uint32_t z, int dzpixenc)
+{
+  uint16_t zval = z_com_table[z & 0x3ffff]|(dzpixenc >> 2);
+  uint8_t hval = dzpixenc & 3;
+  zbuf_write(zcurpixel, zval, hval);
+  hiz_store(zcurpixel, zval, hval);
+}
+
+/*
+ * Opaque-Z runs: the 1-cycle opaque span loops test four pixels of a line
+ * at a time. The framebuffer coverage there is a constant 7, so overflow
+ * is simply "any coverage", and ZMODE_OPAQUE never touches blend_en or the
+ * pixel coverage. The pass mask has bit k set for the k-th pixel along
+ * xinc. blshifta/blshiftb are left alone: the last pixel of every line is
+ * always run through z_compare.
+ */
+static uint32_t z_test_run(int32_t* runsz, uint32_t zcurpixel, int x, int32_t xinc, int z, int32_t dzinc, uint16_t dzpix)
+{
+  uint8_t offx, offy;
+  uint32_t cvg[4], cvbit;
+  int k;
+
+  for (k = 0; k < 4; k++)
+  {
+    lookup_span_cvg(x + k * xinc, &offx, &offy, &cvg[k], &cvbit);
+    runsz[k] = z_correct_clip(offx, offy, ((z + k * dzinc) >> 10) & 0x3fffff, cvg[k]) & 0x3ffff;
+  }
+
+#ifdef USE_SSE
+  int32_t zraw[4] align(16), oz[4] align(16);
+  uint32_t zval, hval;
+
+  for (k = 0; k < 4; k++)
+  {
+    zbuf_read(zcurpixel + k * xinc, &zval, &hval);
+    zraw[k] = (zval << 2) | hval;
+    oz[k] = z_decompress(zval);
+  }
+
+  __m128i zv = _mm_load_si128((__m128i*) zraw);
+  __m128i ozv = _mm_load_si128((__m128i*) oz);
+  __m128i szv = _mm_loadu_si128((__m128i*) runsz);
+  __m128i cvgv = _mm_loadu_si128((__m128i*) cvg);
+  __m128i bias = _mm_set1_epi32(127);
+
+  /* 1 << n for n in 0..15 through the float exponent field. */
+  __m128i rawdzmem = _mm_and_si128(zv, _mm_set1_epi32(0xf));
+  __m128i dzmem = _mm_cvttps_epi32(_mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(rawdzmem, bias), 23)));
+
+  __m128i precision = _mm_and_si128(_mm_srli_epi32(zv, 15), _mm_set1_epi32(0xf));
+  __m128i lowprec = _mm_cmplt_epi32(precision, _mm_set1_epi32(3));
+  __m128i coplanar = _mm_and_si128(lowprec, _mm_cmpeq_epi32(dzmem, _mm_set1_epi32(0x8000)));
+
+  /* 16 >> precision_factor, only meaningful in the lowprec lanes. */
+  __m128i modifier = _mm_cvttps_epi32(_mm_castsi128_ps(_mm_slli_epi32(
+    _mm_sub_epi32(_mm_add_epi32(bias, _mm_set1_epi32(4)), precision), 23)));
+  __m128i dzmem2 = _mm_slli_epi32(dzmem, 1);
+  __m128i raised = _mm_cmpgt_epi32(modifier, dzmem2);
+  raised = _mm_andnot_si128(coplanar, raised);
+  dzmem2 = _mm_or_si128(_mm_andnot_si128(raised, dzmem2), _mm_and_si128(raised, modifier));
+  dzmem = _mm_or_si128(_mm_andnot_si128(lowprec, dzmem), _mm_and_si128(lowprec, dzmem2));
+
+  __m128i big = _mm_cmpgt_epi32(dzmem, _mm_set1_epi32(0x8000));
+  dzmem = _mm_or_si128(_mm_andnot_si128(big, dzmem), _mm_and_si128(big, _mm_set1_epi32(0xffff)));
+
+  __m128i dzpixv = _mm_set1_epi32(dzpix);
+  __m128i pixwins = _mm_cmpgt_epi32(dzpixv, dzmem);
+  __m128i dznew = _mm_or_si128(_mm_andnot_si128(pixwins, dzmem), _mm_and_si128(pixwins, dzpixv));
+  dznew = _mm_slli_epi32(dznew, 3);
+
+  __m128i infront = _mm_cmpgt_epi32(ozv, szv);
+  __m128i nearer = _mm_or_si128(coplanar,
+    _mm_xor_si128(_mm_cmpgt_epi32(_mm_sub_epi32(szv, dznew), ozv), _mm_set1_epi32(-1)));
+  __m128i max = _mm_cmpeq_epi32(ozv, _mm_set1_epi32(0x3ffff));
+  __m128i overflow = _mm_cmpgt_epi32(cvgv, _mm_setzero_si128());
+
+  __m128i pass = _mm_or_si128(max, _mm_or_si128(_mm_and_si128(overflow, infront),
+    _mm_andnot_si128(overflow, nearer)));
+  return _mm_movemask_ps(_mm_castsi128_ps(pass));
+#else
+  uint32_t blend_en, prewrap, mask = 0;
+
+  for (k = 0; k < 4; k++)
+    if (z_compare(zcurpixel + k * xinc, runsz[k], dzpix, 0, &blend_en, &prewrap, &cvg[k], 7))
+      mask |= 1 << k;
+  return mask;
+#endif
+}
+
+/*
+ * Store the Z of the pixels in an opaque-Z run whose bit is set in mask.
+ * With xinc = +-1 the run is four adjacent words, so the SSE path merges
+ * them into the existing Z and hidden bits and writes them back at once.
+ */
+static void z_store_run(uint32_t zcurpixel, int32_t xinc, const int32_t* runsz, int dzpixenc, uint32_t mask)
+{
+#ifdef USE_SSE
+  uint16_t zval[8] align(16);
+  int16_t lanes[8] align(16);
+  uint32_t base = (xinc > 0) ? zcurpixel : zcurpixel - 3;
+  uint32_t znew, hnew, hold, hmask = 0;
+  int k, idx;
+
+  assert(base + 3 <= 0x7FFFFE);
+
+  if (base - zmirror_base < zmirror_span || base + 3 - zmirror_base < zmirror_span)
+  {
+    for (k = 0; k < 4; k++)
+      if (mask >> k & 1)
+        z_store(zcurpixel + k * xinc, runsz[k], dzpixenc);
+    return;
+  }
+
+  for (k = 0; k < 4; k++)
+  {
+    idx = (xinc > 0) ? k : 3 - k;
+    znew = z_com_table[runsz[k]] | (dzpixenc >> 2);
+    zval[idx] = bswap16(znew);
+    lanes[idx] = (mask >> k & 1) ? -1 : 0;
+    if (mask >> k & 1)
+      hiz_store(zcurpixel + k * xinc, znew, dzpixenc & 3);
+    hmask |= (uint32_t)(lanes[idx] & 0xff) << (idx << 3);
+  }
+
+  __m128i keep = _mm_loadl_epi64((__m128i*) lanes);
+  __m128i old = _mm_loadl_epi64((__m128i*) &rdram_16[base]);
+  __m128i merged = _mm_or_si128(_mm_andnot_si128(keep, old),
+    _mm_and_si128(keep, _mm_loadl_epi64((__m128i*) zval)));
+  _mm_storel_epi64((__m128i*) &rdram_16[base], merged);
+
+  hnew = (dzpixenc & 3) * 0x01010101;
+  memcpy(&hold, &hidden_bits[base], sizeof(hold));
+  hold = (hold & ~hmask) | (hnew & hmask);
+  memcpy(&hidden_bits[base], &hold, sizeof(hold));
+#else
+  int k;
+
+  for (k = 0; k < 4; k++)
+    if (mask >> k & 1)
+      z_store(zcurpixel + k * xinc, runsz[k], dzpixenc);
+#endif
+}
+
+/*
+ * Opaque-Z runs defer the Z store past the colour writes of the run, which
+ * is only safe when the line's colour and Z rows do not share memory.
+ */
+static int z_run_line_ok(int curpixel, int length, int32_t xinc)
+{
+  uint32_t lo = (xinc > 0) ? curpixel : curpixel - length;
+  uint32_t hi = lo + length + 1;
+  uint32_t fblo = fb_address + PIXELS_TO_BYTES_SPECIAL4(lo, fb_size);
+  uint32_t fbhi = fb_address + PIXELS_TO_BYTES_SPECIAL4(hi, fb_size) + 4;
+  uint32_t zlo = (zb_address & ~1) + (lo << 1);
+  uint32_t zhi = (zb_address & ~1) + (hi << 1);
+
+  return fbhi <= zlo || zhi <= fblo;
+}
+
+/*
+ * Pending colour writes of the current line. The span loops queue every
+ * pixel that passes the blender, still undithered, into a window of
+ * FBRUN_SIZE adjacent pixels, and pixq_flush dithers the window and hands
+ * it to fbwrite_run_ptr when the line leaves it. Holding writes back is
+ * only safe while nothing the line reads later can see them; when the
+ * line's Z image overlaps its colour image, or its colour reads overlap its
+ * own writes, pixq_begin_line makes every push flush at once.
+ * The renderers flush at the end of every line.
+ */
+static FBRUN pixq align(16);
+static uint16_t pixq_dith[FBRUN_SIZE] align(16);
+static uint32_t pixq_base = 0, pixq_mask = 0;
+static int pixq_backward = 0, pixq_direct = 1;
+
+static void pixq_begin_line(int curpixel, int length, int32_t xinc)
+{
+  uint32_t lo = (xinc > 0) ? curpixel : curpixel - length;
+  int zused = other_modes.z_compare_en || other_modes.z_update_en;
+
+  /* The 32-bit readers take curpixel as a byte offset, so near the start of
+     the image they read words written earlier in the same line. The 16-bit
+     readers keep the low bit of fb_address, which the writers drop, so on an
+     odd address each read straddles a neighbour's write. */
+  pixq_direct = fb_size == PIXEL_SIZE_32BIT && (lo << 2) <= (fb_address & 3) + lo + length + 3;
+  if (fb_size == PIXEL_SIZE_16BIT && (fb_address & 1))
+    pixq_direct = 1;
+  if (zused && !z_run_line_ok(curpixel, length, xinc))
+    pixq_direct = 1;
+
+  pixq_backward = xinc < 0;
+}
+
+static forceinline void pixq_push(uint32_t curpixel, uint32_t r, uint32_t g, uint32_t b, int dith, uint32_t blend_en, uint32_t curpixel_cvg, uint32_t curpixel_memcvg)
+{
+  uint32_t k = curpixel - pixq_base;
+
+  if (!pixq_mask || k >= FBRUN_SIZE)
+  {
+    pixq_flush();
+    pixq_base = pixq_backward ? curpixel - (FBRUN_SIZE - 1) : curpixel;
+    k = curpixel - pixq_base;
+  }
+
+  pixq.r[k] = r;
+  pixq.g[k] = g;
+  pixq.b[k] = b;
+  pixq.blend_en[k] = blend_en;
+  pixq.cvg[k] = curpixel_cvg;
+  pixq.memcvg[k] = curpixel_memcvg;
+  pixq_dith[k] = dith;
+  pixq_mask |= 1 << k;
+
+  if (pixq_direct)
+    pixq_flush();
+}
+
+static void pixq_flush(void)
+{
+  if (!pixq_mask)
+    return;
+
+  dither_run(pixq_mask);
+  fbwrite_run_ptr(pixq_base, pixq_mask, &pixq);
+  pixq_mask = 0;
+}
+
+/*
+ * Colour reads of the current line. On a 16-bit image whose line can't see
+ * its own writes (see pixq_begin_line) the whole line is unpacked up front
+ * and fbread1_ptr/fbread2_ptr read from the unpacked row; otherwise they are
+ * the plain per-pixel readers. The next scanline's colour and Z rows are
+ * prefetched either way.
+ */
+static void fbrow_begin_line(int curpixel, int length, int32_t xinc, int zhidden)
+{
+  uint32_t lo = (xinc > 0) ? curpixel : curpixel - length;
+  int rowed = 0;
+
+  if (length < 0)
+    return;
+
+  fbrow_prefetch(lo + fb_width, length + 1);
+
+  if (!zhidden && !pixq_direct && fb_size == PIXEL_SIZE_16BIT)
+    rowed = FBLoadRow16(lo, length + 1);
+
+  fbread1_ptr = rowed ? FBReadRowFuncLUT[0] : FBReadFuncLUT[fb_size];
+  fbread2_ptr = rowed ? FBReadRowFuncLUT[1] : FBReadFunc2LUT[fb_size];
+}
+
+static void fbrow_prefetch(uint32_t lo, int count)
+{
+  uint32_t fb = fb_address + PIXELS_TO_BYTES(lo, fb_size);
+  uint32_t zb = (zb_address & ~1) + (lo << 1);
+  uint32_t fbbytes = PIXELS_TO_BYTES(count, fb_size);
+  uint32_t k;
+
+  for (k = 0; k < fbbytes; k += 64)
+    __builtin_prefetch(rdram_8 + ((fb + k) & 0x7fffff));
+
+  if (other_modes.z_compare_en || other_modes.z_update_en)
+  {
+    for (k = 0; k < (uint32_t)count << 1; k += 64)
+      __builtin_prefetch(rdram_8 + ((zb + k) & 0x7fffff));
+  }
+}
+
+/* rgb_dither_ptr over the queued pixels in mask. A channel whose low three
+   bits exceed its threshold is rounded up to the next multiple of 8,
+   saturating at 0xff; rgb_dither_sel 2 offsets the green and blue
+   thresholds by 3 and 5. */
+static void dither_run(uint32_t mask)
+{
+  int k;
+
+  if (other_modes.rgb_dither_sel == 3)
+    return;
+
+#ifdef USE_SSE
+  __m128i seven = _mm_set1_epi16(7);
+  __m128i f8 = _mm_set1_epi16(0xf8);
+  __m128i eight = _mm_set1_epi16(8);
+  __m128i ff = _mm_set1_epi16(0xff);
+  __m128i goff = _mm_set1_epi16(other_modes.rgb_dither_sel == 2 ? 3 : 0);
+  __m128i boff = _mm_set1_epi16(other_modes.rgb_dither_sel == 2 ? 5 : 0);
+  __m128i dith, dg, db, v, up, over;
+
+  /* Lanes outside mask are dithered too; the writers ignore them. */
+  for (k = 0; k < FBRUN_SIZE; k += 8)
+  {
+    if (!((mask >> k) & 0xff))
+      continue;
+
+    dith = _mm_load_si128((__m128i*) &pixq_dith[k]);
+    dg = _mm_and_si128(_mm_add_epi16(dith, goff), seven);
+    db = _mm_and_si128(_mm_add_epi16(dith, boff), seven);
+
+    v = _mm_load_si128((__m128i*) &pixq.r[k]);
+    up = _mm_min_epi16(_mm_add_epi16(_mm_and_si128(v, f8), eight), ff);
+    over = _mm_cmpgt_epi16(_mm_and_si128(v, seven), dith);
+    v = _mm_or_si128(_mm_and_si128(over, up), _mm_andnot_si128(over, v));
+    _mm_store_si128((__m128i*) &pixq.r[k], v);
+
+    v = _mm_load_si128((__m128i*) &pixq.g[k]);
+    up = _mm_min_epi16(_mm_add_epi16(_mm_and_si128(v, f8), eight), ff);
+    over = _mm_cmpgt_epi16(_mm_and_si128(v, seven), dg);
+    v = _mm_or_si128(_mm_and_si128(over, up), _mm_andnot_si128(over, v));
+    _mm_store_si128((__m128i*) &pixq.g[k], v);
+
+    v = _mm_load_si128((__m128i*) &pixq.b[k]);
+    up = _mm_min_epi16(_mm_add_epi16(_mm_and_si128(v, f8), eight), ff);
+    over = _mm_cmpgt_epi16(_mm_and_si128(v, seven), db);
+    v = _mm_or_si128(_mm_and_si128(over, up), _mm_andnot_si128(over, v));
+    _mm_store_si128((__m128i*) &pixq.b[k], v);
+  }
+#else
+  int32_t r, g, b;
+
+  for (; mask; mask &= mask - 1)
+  {
+    k = __builtin_ctz(mask);
+    r = pixq.r[k];
+    g = pixq.g[k];
+    b = pixq.b[k];
+    rgb_dither_ptr(&r, &g, &b, pixq_dith[k]);
+    pixq.r[k] = r;
+    pixq.g[k] = g;
+    pixq.b[k] = b;
+  }
+#endif
+}
+
+/*
+ * Interleaved Z: with RDPSetZMirror(1), Z accesses go to zmirror, which
+ * holds each Z word together with its hidden bits (word | hidden << 16), so
+ * one Z access touches one cache line instead of two. The mirror covers
+ * ZMIRROR_SIZE pixels from the Z image base and is loaded from RDRAM in
+ * blocks of 1 << ZMIRROR_SHIFT pixels on first touch. Dirty blocks are
+ * written back on SYNC_FULL, RDPFlushRDRAM and texture loads; blocks that
+ * the colour image of a primitive may touch are written back and dropped
+ * before it is drawn.
+ */
+static forceinline void zbuf_read(uint32_t zcurpixel, uint32_t* zval, uint32_t* hval)
+{
+  uint32_t off = zcurpixel - zmirror_base;
+
+  if (off < zmirror_span)
+  {
+    if (zmirror_state[off >> ZMIRROR_SHIFT] == ZBLOCK_EMPTY)
+      zmirror_load(off >> ZMIRROR_SHIFT);
+    *zval = zmirror[off] & 0xffff;
+    *hval = zmirror[off] >> 16;
+  }
+  else
+    PAIRREAD16(*zval, *hval, zcurpixel);
+}
+
+static forceinline void zbuf_write(uint32_t zcurpixel, uint32_t zval, uint32_t hval)
+{
+  uint32_t off = zcurpixel - zmirror_base;
+
+  if (off < zmirror_span)
+  {
+    if (zmirror_state[off >> ZMIRROR_SHIFT] == ZBLOCK_EMPTY)
+      zmirror_load(off >> ZMIRROR_SHIFT);
+    zmirror_state[off >> ZMIRROR_SHIFT] = ZBLOCK_DIRTY;
+    zmirror[off] = zval | (hval << 16);
+  }
+  else
+    PAIRWRITE16(zcurpixel, zval, hval);
+}
+
+/* Pixels of block b that lie inside RDRAM. */
+static uint32_t zmirror_block_pixels(uint32_t b)
+{
+  uint32_t idx = zmirror_base + (b << ZMIRROR_SHIFT);
+
+  if (idx >= 0x400000)
+    return 0;
+  return (0x400000 - idx < (1 << ZMIRROR_SHIFT)) ? 0x400000 - idx : (1 << ZMIRROR_SHIFT);
+}
+
+static void zmirror_load(uint32_t b)
+{
+  uint32_t idx = zmirror_base + (b << ZMIRROR_SHIFT);
+  uint32_t* dst = &zmirror[b << ZMIRROR_SHIFT];
+  uint32_t k = 0, n = zmirror_block_pixels(b);
+
+#ifdef USE_SSE
+  __m128i z, h;
+
+  for (; k + 8 <= n; k += 8)
+  {
+    z = _mm_loadu_si128((__m128i*) &rdram_16[idx + k]);
+    z = _mm_or_si128(_mm_slli_epi16(z, 8), _mm_srli_epi16(z, 8));
+    h = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) &hidden_bits[idx + k]), _mm_setzero_si128());
+    _mm_store_si128((__m128i*) &dst[k], _mm_unpacklo_epi16(z, h));
+    _mm_store_si128((__m128i*) &dst[k + 4], _mm_unpackhi_epi16(z, h));
+  }
+#endif
+  for (; k < n; k++)
+    dst[k] = bswap16(rdram_16[idx + k]) | (hidden_bits[idx + k] << 16);
+
+  zmirror_state[b] = ZBLOCK_CLEAN;
+  if (b < zmirror_first)
+    zmirror_first = b;
+  if (b > zmirror_last)
+    zmirror_last = b;
+}
+
+static void zmirror_store(uint32_t b)
+{
+  uint32_t idx = zmirror_base + (b << ZMIRROR_SHIFT);
+  const uint32_t* src = &zmirror[b << ZMIRROR_SHIFT];
+  uint32_t k = 0, n = zmirror_block_pixels(b);
+
+#ifdef USE_SSE
+  __m128i lo, hi, z, h;
+
+  for (; k + 8 <= n; k += 8)
+  {
+    lo = _mm_load_si128((__m128i*) &src[k]);
+    hi = _mm_load_si128((__m128i*) &src[k + 4]);
+    z = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(lo, 16), 16),
+      _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16));
+    z = _mm_or_si128(_mm_slli_epi16(z, 8), _mm_srli_epi16(z, 8));
+    h = _mm_packs_epi32(_mm_srli_epi32(lo, 16), _mm_srli_epi32(hi, 16));
+    _mm_storeu_si128((__m128i*) &rdram_16[idx + k], z);
+    _mm_storel_epi64((__m128i*) &hidden_bits[idx + k], _mm_packus_epi16(h, h));
+  }
+#endif
+  for (; k < n; k++)
+  {
+    rdram_16[idx + k] = bswap16(src[k] & 0xffff);
+    hidden_bits[idx + k] = src[k] >> 16;
+  }
+
+  zmirror_state[b] = ZBLOCK_CLEAN;
+}
+
+static void zmirror_writeback(void)
+{
+  uint32_t b;
+
+  for (b = zmirror_first; b <= zmirror_last; b++)
+    if (zmirror_state[b] == ZBLOCK_DIRTY)
+      zmirror_store(b);
+}
+
+static void zmirror_drop(void)
+{
+  if (zmirror_first <= zmirror_last)
+    memset(&zmirror_state[zmirror_first], ZBLOCK_EMPTY, zmirror_last - zmirror_first + 1);
+  zmirror_first = ZMIRROR_BLOCKS;
+  zmirror_last = 0;
+}
+
+static void zmirror_release(void)
+{
+  zmirror_writeback();
+  zmirror_drop();
+}
+
+/*
+ * The host wrote [address, address + length). Blocks over that range are
+ * dropped; their dirty pixels are written back first except for the bytes
+ * the host wrote, which win.
+ */
+static void zmirror_invalidate_range(uint32_t address, uint32_t length)
+{
+  uint32_t b, k, n, idx, byte;
+  uint16_t zval;
+
+  for (b = zmirror_first; b <= zmirror_last; b++)
+  {
+    idx = zmirror_base + (b << ZMIRROR_SHIFT);
+    n = zmirror_block_pixels(b);
+    if (zmirror_state[b] == ZBLOCK_EMPTY || (idx << 1) >= address + length || address >= (idx + n) << 1)
+      continue;
+
+    if (zmirror_state[b] == ZBLOCK_DIRTY)
+    {
+      for (k = 0; k < n; k++)
+      {
+        zval = bswap16(zmirror[(b << ZMIRROR_SHIFT) + k] & 0xffff);
+        byte = (idx + k) << 1;
+        if (byte - address >= length)
+          rdram_8[byte] = ((uint8_t*) &zval)[0];
+        if (byte + 1 - address >= length)
+          rdram_8[byte + 1] = ((uint8_t*) &zval)[1];
+        hidden_bits[idx + k] = zmirror[(b << ZMIRROR_SHIFT) + k] >> 16;
+      }
+    }
+
+    zmirror_state[b] = ZBLOCK_EMPTY;
+  }
+}
+
+/*
+ * Called once per primitive, next to hiz_begin_primitive. A primitive whose
+ * colour image may reach the Z rows it (or a coarse Z refresh around it)
+ * touches runs with the mirror off, since its colour writes go to RDRAM.
+ */
+static void zmirror_begin_primitive(int start, int end)
+{
+  uint32_t fblo, fbhi, zlo, zhi, mlo, mhi;
+  int zoverlap, moverlap;
+
+  if (!zmirror_enabled)
+    return;
+
+  if ((zb_address >> 1) != zmirror_base)
+  {
+    zmirror_release();
+    zmirror_base = zb_address >> 1;
+  }
+
+  start = (start < 0) ? 0 : start;
+  end = (end < start) ? start : end;
+
+  /* FBRead_32 reads at byte fb_address + curpixel, below the pixel it writes. */
+  if (fb_size == PIXEL_SIZE_32BIT)
+    fblo = fb_address + fb_width * start;
+  else
+    fblo = fb_address + PIXELS_TO_BYTES_SPECIAL4(fb_width * start, fb_size);
+  fbhi = fb_address + PIXELS_TO_BYTES_SPECIAL4(fb_width * (end + 1) + 1024, fb_size) + 4;
+
+  start &= ~((1 << HIZ_SHIFT) - 1);
+  end |= (1 << HIZ_SHIFT) - 1;
+  zlo = (fb_width * start) >> ZMIRROR_SHIFT;
+  zhi = ((fb_width * (end + 1) + 1024) >> ZMIRROR_SHIFT) + 1;
+  zlo = (zmirror_base + (zlo << ZMIRROR_SHIFT)) << 1;
+  zhi = (zmirror_base + (zhi << ZMIRROR_SHIFT)) << 1;
+  zoverlap = fblo < zhi && zlo < fbhi;
+
+  mlo = (zmirror_base + (zmirror_first << ZMIRROR_SHIFT)) << 1;
+  mhi = (zmirror_base + ((zmirror_last + 1) << ZMIRROR_SHIFT)) << 1;
+  moverlap = zmirror_first <= zmirror_last && fblo < mhi && mlo < fbhi;
+
+  if (zoverlap || moverlap)
+    zmirror_release();
+
+  if (zoverlap || zmirror_base >= 0x400000)
+    zmirror_span = 0;
+  else
+    zmirror_span = (0x400000 - zmirror_base < ZMIRROR_SIZE) ? 0x400000 - zmirror_base : ZMIRROR_SIZE;
+}
+
+/*
+ * Coarse Z: a conservative depth bound for each 8x8 block of the Z image
+ * (zb_address, fb_width pixels per row). A block's bound is at least
+ * oz + (dzmem << 3) of every pixel in it, using the dzmem that z_compare
+ * would derive, or HIZ_NEVER if any pixel is at max depth or forces
+ * coplanar. A pixel with sz past both that bound and maxz + (dzpix << 3)
+ * fails z_compare in every z_mode, which lets the early-Z span loops drop
+ * whole lines without touching the Z buffer.
+ *
+ * Bounds only grow between refreshes: z_store merges the new pixel in and
+ * marks the block loose, and a loose block is re-read from RDRAM the first
+ * time a later primitive asks for it. Everything is dropped at once (by
+ * bumping hiz_generation) when the Z image moves, when a primitive's
+ * colour writes may land in it, or when the host writes RDRAM.
+ *
+ * Coarse Z is off unless the host turns it on with RDPSetCoarseZ, because
+ * it only hears of host writes through RDPInvalidateRDRAM.
+ */
+static int32_t hiz_pixel_bound(uint32_t zval, uint32_t hval, int32_t* oz)
+{
+  uint32_t dzmem = dz_decompress(((zval & 3) << 2) | hval);
+  int precision_factor = (zval >> 13) & 0xf;
+
+  *oz = z_decompress(zval);
+  if (*oz == 0x3ffff)
+    return HIZ_NEVER;
+
+  if (precision_factor < 3)
+  {
+    if (dzmem == 0x8000)
+      return HIZ_NEVER;
+    dzmem <<= 1;
+    if (dzmem <= (uint32_t)(16 >> precision_factor))
+      dzmem = 16 >> precision_factor;
+  }
+  if (dzmem > 0x8000)
+    dzmem = 0xffff;
+
+  return *oz + (dzmem << 3);
+}
+
+static void hiz_invalidate(void)
+{
+  hiz_generation++;
+  hiz_tracking = 0;
+}
+
+static void hiz_refresh(HIZBLOCK* blk, int bx, int by)
+{
+  uint32_t zval, hval, idx;
+  int32_t oz, bound;
+  int x, y;
+
+  blk->bound = blk->maxz = 0;
+  for (y = by << HIZ_SHIFT; y < ((by + 1) << HIZ_SHIFT); y++)
+  {
+    for (x = bx << HIZ_SHIFT; x < ((bx + 1) << HIZ_SHIFT) && x < (int)hiz_width; x++)
+    {
+      idx = hiz_base + y * hiz_width + x;
+      if (idx > 0x3fffff)
+      {
+        blk->bound = HIZ_NEVER;
+        break;
+      }
+      zbuf_read(idx, &zval, &hval);
+      bound = hiz_pixel_bound(zval, hval, &oz);
+      if (bound > blk->bound)
+        blk->bound = bound;
+      if (oz > blk->maxz)
+        blk->maxz = oz;
+    }
+  }
+
+  blk->generation = hiz_generation;
+  blk->primitive = hiz_primitive;
+  blk->loose = 0;
+  hiz_tracking = 1;
+}
+
+static void hiz_store(uint32_t zcurpixel, uint32_t zval, uint32_t hval)
+{
+  uint32_t idx, x, y;
+  int32_t oz, bound;
+  HIZBLOCK* blk;
+
+  if (!hiz_tracking)
+    return;
+
+  idx = zcurpixel - hiz_base;
+  if (idx >= hiz_width * (HIZ_ROWS << HIZ_SHIFT))
+    return;
+  y = idx / hiz_width;
+  x = idx - y * hiz_width;
+
+  blk = &hiz[(y >> HIZ_SHIFT) * HIZ_COLS + (x >> HIZ_SHIFT)];
+  if (blk->generation != hiz_generation)
+    return;
+
+  bound = hiz_pixel_bound(zval, hval, &oz);
+  if (bound > blk->bound)
+    blk->bound = bound;
+  if (oz > blk->maxz)
+    blk->maxz = oz;
+  blk->loose = 1;
+}
+
+/*
+ * Called once per primitive, before its spans are drawn, with the range of
+ * lines it covers.
+ */
+static void hiz_begin_primitive(int start, int end)
+{
+  uint32_t fblo, fbhi, zlo, zhi;
+
+  if ((zb_address >> 1) != hiz_base || (uint32_t)fb_width != hiz_width)
+  {
+    hiz_invalidate();
+    hiz_base = zb_address >> 1;
+    hiz_width = fb_width;
+  }
+  hiz_primitive++;
+
+  if (!hiz_tracking)
+    return;
+
+  /* Scissored x can run past fb_width, hence the extra 1024 pixels. */
+  start = (start < 0) ? 0 : start;
+  end = (end < start) ? start : end;
+  fblo = fb_address + PIXELS_TO_BYTES_SPECIAL4(fb_width * start, fb_size);
+  fbhi = fb_address + PIXELS_TO_BYTES_SPECIAL4(fb_width * (end + 1) + 1024, fb_size) + 4;
+  zlo = hiz_base << 1;
+  zhi = zlo + ((hiz_width * (HIZ_ROWS << HIZ_SHIFT)) << 1);
+  if (fblo < zhi && zlo < fbhi)
+    hiz_invalidate();
+}
+
+/*
+ * Whether every pixel j < length of line y, starting at x and stepping by
+ * xinc, is certain to fail z_compare. z is the unshifted span Z at x.
+ */
+static int hiz_line_rejected(int y, int x, int32_t xinc, int length, int z, int32_t dzinc, uint16_t dzpix)
+{
+  uint8_t offx, offy;
+  uint32_t cvg, cvbit;
+  int32_t sz, threshold = 0;
+  int lastblock = -1, block, px, k;
+  HIZBLOCK* blk;
+
+  if (!hiz_enabled || y < 0 || y >= (HIZ_ROWS << HIZ_SHIFT) || length <= 0)
+    return 0;
+  px = (xinc > 0) ? x + length - 1 : x - length + 1;
+  if (x < 0 || px < 0 || x >= (int)hiz_width || px >= (int)hiz_width)
+    return 0;
+
+  for (k = 0, px = x; k < length; k++, px += xinc)
+  {
+    block = (y >> HIZ_SHIFT) * HIZ_COLS + (px >> HIZ_SHIFT);
+    if (block != lastblock)
+    {
+      blk = &hiz[block];
+      if (blk->generation != hiz_generation || (blk->loose && blk->primitive != hiz_primitive))
+        hiz_refresh(blk, px >> HIZ_SHIFT, y >> HIZ_SHIFT);
+      if (blk->bound == HIZ_NEVER)
+        return 0;
+      threshold = blk->maxz + (dzpix << 3);
+      if (blk->bound > threshold)
+        threshold = blk->bound;
+      lastblock = block;
+    }
+
+    lookup_span_cvg(px, &offx, &offy, &cvg, &cvbit);
+    sz = z_correct_clip(offx, offy, ((z + k * dzinc) >> 10) & 0x3fffff, cvg) & 0x3ffff;
+    if (sz <= threshold)
+      return 0;
+  }
+
+  return 1;
 }
 
 static uint32_t dz_decompress(uint32_t dz_compressed)
@@ -6634,7 +8783,7 @@ static uint32_t z_compare(uint32_t zcurpixel, uint32_t sz, uint16_t dzpix, int d
 
   if (other_modes.z_compare_en)
   {
-    PAIRREAD16(zval, hval, zcurpixel);
+    zbuf_read(zcurpixel, &zval, &hval);
     oz = z_decompress(zval);    
     rawdzmem = ((zval & 3) << 2) | hval;
     dzmem = dz_decompress(rawdzmem);
@@ -6772,6 +8921,15 @@ static void calculate_clamp_diffs(uint32_t i)
 {
   tile[i].f.clampdiffs = ((tile[i].sh >> 2) - (tile[i].sl >> 2)) & 0x3ff;
   tile[i].f.clampdifft = ((tile[i].th >> 2) - (tile[i].tl >> 2)) & 0x3ff;
+
+#ifdef USE_SSE
+  tile[i].f.relative = _mm_setr_epi32(tile[i].sl << 3, tile[i].tl << 3,
+    tile[i].sl << 3, tile[i].tl << 3);
+  tile[i].f.maxst = _mm_setr_epi32(tile[i].sh - 1, tile[i].th - 1,
+    tile[i].sh - 1, tile[i].th - 1);
+  tile[i].f.clampdiff = _mm_setr_epi32(tile[i].f.clampdiffs,
+    tile[i].f.clampdifft, tile[i].f.clampdiffs, tile[i].f.clampdifft);
+#endif
 }
 
 static void calculate_tile_derivs(uint32_t i)
@@ -6782,14 +8940,73 @@ static void calculate_tile_derivs(uint32_t i)
   tile[i].f.masktclamped = tile[i].mask_t <= 10 ? tile[i].mask_t : 10;
   tile[i].f.notlutswitch = (tile[i].format << 2) | tile[i].size;
   tile[i].f.tlutswitch = (tile[i].size << 2) | ((tile[i].format + 2) & 3);
+  calculate_tile_sampler(i);
+
+#ifdef USE_SSE
+  {
+    int32_t clamps = -tile[i].f.clampens, clampt = -tile[i].f.clampent;
+    int32_t wraps = 0, wrapt = 0, masks = ~0, maskt = ~0;
+
+    /* SIGN16 and the shift folded into a pair of 32-bit shift counts. */
+    tile[i].f.shl_s = _mm_cvtsi32_si128(tile[i].shift_s < 11 ? 16 : 32 - tile[i].shift_s);
+    tile[i].f.shr_s = _mm_cvtsi32_si128(tile[i].shift_s < 11 ? 16 + tile[i].shift_s : 16);
+    tile[i].f.shl_t = _mm_cvtsi32_si128(tile[i].shift_t < 11 ? 16 : 32 - tile[i].shift_t);
+    tile[i].f.shr_t = _mm_cvtsi32_si128(tile[i].shift_t < 11 ? 16 + tile[i].shift_t : 16);
+
+    if (tile[i].mask_s)
+    {
+      wraps = tile[i].ms ? 1 << tile[i].f.masksclamped : 0;
+      masks = maskbits_table[tile[i].mask_s];
+    }
+
+    if (tile[i].mask_t)
+    {
+      wrapt = tile[i].mt ? 1 << tile[i].f.masktclamped : 0;
+      maskt = maskbits_table[tile[i].mask_t];
+    }
+
+    tile[i].f.clampen = _mm_setr_epi32(clamps, clampt, clamps, clampt);
+    tile[i].f.wrapbit = _mm_setr_epi32(wraps, wrapt, wraps, wrapt);
+    tile[i].f.maskbits = _mm_setr_epi32(masks, maskt, masks, maskt);
+    tile[i].f.coupled = _mm_setr_epi32(0, 0,
+      tile[i].format != FORMAT_YUV ? 1 : 2, 1);
+  }
+#endif
+}
+
+static void calculate_tile_sampler(uint32_t i)
+{
+  if (!other_modes.en_tlut)
+  {
+    tile[i].f.fetch_texel = FetchTexelFuncLUT[tile[i].f.notlutswitch];
+    tile[i].f.fetch_texel_quadro = FetchTexelQuadroFuncLUT[tile[i].f.notlutswitch];
+  }
+  else
+  {
+    tile[i].f.fetch_texel = FetchTexelEntlutFuncLUT[tile[i].f.tlutswitch];
+    tile[i].f.fetch_texel_quadro = FetchTexelEntlutQuadroFuncLUT[tile[i].f.tlutswitch];
+  }
+}
+
+static forceinline int z_correct_clip(int offx, int offy, int sz, uint32_t curpixel_cvg)
+{
+  int zanded;
+
+  if (curpixel_cvg == 8)
+    sz = sz >> 3;
+  else
+    sz = ((sz << 2) + offx * spans_cdz + offy * spans_dzdy) >> 5;
+
+  static const uint32_t zandtable[4] = {0x3FFFF, 0x3FFFF, 0,       0};
+  static const uint32_t zortable[4] =  {0,       0,       0x3FFFF, 0};
+
+  zanded = (sz & 0x00060000) >> 17;
+  return (sz & zandtable[zanded]) | zortable[zanded];
 }
 
 static void rgbaz_correct_clip(int offx, int offy, int r, int g, int b, int a, int* z, uint32_t curpixel_cvg)
 {
   int summand_r, summand_b, summand_g, summand_a;
-  int summand_z;
-  int sz = *z;
-  int zanded;
 
   if (curpixel_cvg == 8)
   {
@@ -6797,7 +9014,6 @@ static void rgbaz_correct_clip(int offx, int offy, int r, int g, int b, int a, i
     g >>= 2;
     b >>= 2;
     a >>= 2;
-    sz = sz >> 3;
   }
   else
   {
@@ -6805,13 +9021,11 @@ static void rgbaz_correct_clip(int offx, int offy, int r, int g, int b, int a, i
     summand_g = offx * spans_cdg + offy * spans_dgdy;
     summand_b = offx * spans_cdb + offy * spans_dbdy;
     summand_a = offx * spans_cda + offy * spans_dady;
-    summand_z = offx * spans_cdz + offy * spans_dzdy;
 
     r = ((r << 2) + summand_r) >> 4;
     g = ((g << 2) + summand_g) >> 4;
     b = ((b << 2) + summand_b) >> 4;
     a = ((a << 2) + summand_a) >> 4;
-    sz = ((sz << 2) + summand_z) >> 5;
   }
   
   shade_color.r = special_9bit_clamptable[r & 0x1ff];
@@ -6819,11 +9033,7 @@ static void rgbaz_correct_clip(int offx, int offy, int r, int g, int b, int a, i
   shade_color.b = special_9bit_clamptable[b & 0x1ff];
   shade_color.a = special_9bit_clamptable[a & 0x1ff];
 
-  static const uint32_t zandtable[4] = {0x3FFFF, 0x3FFFF, 0,       0};
-  static const uint32_t zortable[4] =  {0,       0,       0x3FFFF, 0};
-
-  zanded = (sz & 0x00060000) >> 17;
-  *z = (sz & zandtable[zanded]) | zortable[zanded];
+  *z = z_correct_clip(offx, offy, *z, curpixel_cvg);
 }
 
 static void tcdiv_nopersp(int32_t ss, int32_t st, int32_t sw, int32_t* sss, int32_t* sst)
@@ -7182,7 +9392,7 @@ static void tclod_1cycle_current(int32_t* sss, int32_t* sst, int32_t nexts, int3
     int nextscan = scanline + 1;
 
     
-    if (span[nextscan].validline)
+    if (span.validline[nextscan])
     {
       if (!sigs->endspan || !sigs->longspan)
       {
@@ -7201,9 +9411,9 @@ static void tclod_1cycle_current(int32_t* sss, int32_t* sst, int32_t nexts, int3
       }
       else
       {
-        fart = (span[nextscan].t + dtinc) >> 16; 
-        fars = (span[nextscan].s + dsinc) >> 16; 
-        farsw = (span[nextscan].w + dwinc) >> 16;
+        fart = (span.t[nextscan] + dtinc) >> 16; 
+        fars = (span.s[nextscan] + dsinc) >> 16; 
+        farsw = (span.w[nextscan] + dwinc) >> 16;
       }
     }
     else
@@ -7254,7 +9464,7 @@ static void tclod_1cycle_next(int32_t* sss, int32_t* sst, int32_t s, int32_t t,
     
     int nextscan = scanline + 1;
     
-    if (span[nextscan].validline)
+    if (span.validline[nextscan])
     {
       if (!sigs->nextspan)
       {
@@ -7279,9 +9489,9 @@ static void tclod_1cycle_next(int32_t* sss, int32_t* sst, int32_t s, int32_t t,
         }
         else
         {
-          nextt = span[nextscan].t;
-          nexts = span[nextscan].s;
-          nextsw = span[nextscan].w;
+          nextt = span.t[nextscan];
+          nexts = span.s[nextscan];
+          nextsw = span.w[nextscan];
           fart = (nextt + dtinc) >> 16; 
           fars = (nexts + dsinc) >> 16; 
           farsw = (nextsw + dwinc) >> 16;
@@ -7294,9 +9504,9 @@ static void tclod_1cycle_next(int32_t* sss, int32_t* sst, int32_t s, int32_t t,
       {
         if (sigs->longspan || sigs->midspan)
         {
-          nextt = span[nextscan].t + dtinc;
-          nexts = span[nextscan].s + dsinc;
-          nextsw = span[nextscan].w + dwinc;
+          nextt = span.t[nextscan] + dtinc;
+          nexts = span.s[nextscan] + dsinc;
+          nextsw = span.w[nextscan] + dwinc;
           fart = (nextt + dtinc) >> 16; 
           fars = (nexts + dsinc) >> 16; 
           farsw = (nextsw + dwinc) >> 16;
@@ -7423,7 +9633,7 @@ static void get_texel1_1cycle(int32_t* s1, int32_t* t1, int32_t s, int32_t t, in
 {
   int32_t nexts, nextt, nextsw;
   
-  if (!sigs->endspan || !sigs->longspan || !span[scanline + 1].validline)
+  if (!sigs->endspan || !sigs->longspan || !span.validline[scanline + 1])
   {
   
   
@@ -7434,9 +9644,9 @@ static void get_texel1_1cycle(int32_t* s1, int32_t* t1, int32_t s, int32_t t, in
   else
   {
     int32_t nextscan = scanline + 1;
-    nextt = span[nextscan].t >> 16;
-    nexts = span[nextscan].s >> 16;
-    nextsw = span[nextscan].w >> 16;
+    nextt = span.t[nextscan] >> 16;
+    nexts = span.s[nextscan] >> 16;
+    nextsw = span.w[nextscan] >> 16;
   }
 
   tcdiv_ptr(nexts, nextt, nextsw, s1, t1);
@@ -7508,3 +9718,136 @@ void lodfrac_lodtile_signals(int lodclamp, int32_t lod, uint32_t* l_tile, uint32
   lod_frac = lf;
 }
 
+/*
+ * Dirty rectangles: every primitive widens the box of the colour image it
+ * is drawn to by the lines and x extent its spans cover, whether or not
+ * the pixels end up passing the blender and Z tests. The last
+ * DIRTY_IMAGES colour images drawn to are tracked; dirty_cur caches the
+ * entry of the current one until the next SET_COLOR_IMAGE.
+ *
+ * An image spans its first rows lines, the most ever drawn to it. A write
+ * to those bytes by the host, through another colour image or through the
+ * Z image makes its box unreliable, and the entry is marked lost instead.
+ * Nothing watches the lines below rows, so an entry that grows is lost too,
+ * and that includes a new entry.
+ */
+static DIRTYRECT* dirty_lookup(uint32_t address, int create)
+{
+  DIRTYRECT* victim = &dirty[0];
+  int k;
+
+  for (k = 0; k < DIRTY_IMAGES; k++)
+  {
+    if (dirty[k].width && dirty[k].address == address)
+      return &dirty[k];
+    if (dirty[k].stamp < victim->stamp)
+      victim = &dirty[k];
+  }
+
+  if (!create)
+    return NULL;
+
+  memset(victim, 0, sizeof(*victim));
+  victim->address = address;
+  victim->width = fb_width;
+  victim->size = fb_size;
+  return victim;
+}
+
+static void dirty_mark_primitive(int start, int end)
+{
+  int i, lo, hi;
+  int x0 = 0x2000, x1 = -1, y0 = -1, y1 = -1;
+  DIRTYRECT* d;
+
+  for (i = start; i <= end; i++)
+  {
+    if (span.validline[i])
+    {
+      lo = (span.lx[i] < span.rx[i]) ? span.lx[i] : span.rx[i];
+      hi = (span.lx[i] < span.rx[i]) ? span.rx[i] : span.lx[i];
+      x0 = (lo < x0) ? lo : x0;
+      x1 = (hi > x1) ? hi : x1;
+      y0 = (y0 < 0) ? i : y0;
+      y1 = i;
+    }
+  }
+
+  if (y0 < 0 || !fb_width)
+    return;
+
+  /* Copy mode byte runs reach one byte below the low end of a span, and
+     pixels past the right edge land on the following lines. */
+  if (other_modes.cycle_type == CYCLE_TYPE_COPY)
+    x0--;
+  x1++;
+  y1++;
+  if (x0 < 0)
+    y0 = (y0 > 0) ? y0 - 1 : 0;
+  if (x1 > fb_width)
+    y1 += (x1 - 1) / fb_width;
+  if (x0 < 0 || x1 > fb_width)
+  {
+    x0 = 0;
+    x1 = fb_width;
+  }
+
+  if (!dirty_cur)
+    dirty_cur = dirty_lookup(fb_address, 1);
+  d = dirty_cur;
+  d->stamp = ++dirty_clock;
+
+  if (d->width != fb_width || d->size != fb_size)
+  {
+    d->width = fb_width;
+    d->size = fb_size;
+    d->rows = 0;
+    d->lost = 1;
+  }
+
+  /* Nothing watched the new lines for other writers until now. */
+  if (y1 > d->rows)
+  {
+    d->lost = 1;
+    d->rows = y1;
+  }
+
+  dirty_lose_range(fb_address + PIXELS_TO_BYTES_SPECIAL4(fb_width * y0, fb_size),
+    fb_address + PIXELS_TO_BYTES_SPECIAL4(fb_width * y1, fb_size), d);
+  if (other_modes.z_update_en)
+    dirty_lose_range(zb_address + ((fb_width * y0) << 1), zb_address + ((fb_width * y1) << 1), NULL);
+
+  if (d->x0 >= d->x1)
+  {
+    d->x0 = x0;
+    d->y0 = y0;
+    d->x1 = x1;
+    d->y1 = y1;
+    return;
+  }
+
+  d->x0 = (x0 < d->x0) ? x0 : d->x0;
+  d->y0 = (y0 < d->y0) ? y0 : d->y0;
+  d->x1 = (x1 > d->x1) ? x1 : d->x1;
+  d->y1 = (y1 > d->y1) ? y1 : d->y1;
+}
+
+/* Marks lost every tracked image but except that overlaps bytes [lo, hi).
+   Z writes pass no exception, so an image aliasing its own Z is lost too. */
+static void dirty_lose_range(uint32_t lo, uint32_t hi, const DIRTYRECT* except)
+{
+  uint32_t dlo, dhi;
+  int k;
+
+  for (k = 0; k < DIRTY_IMAGES; k++)
+  {
+    if (!dirty[k].width || &dirty[k] == except)
+      continue;
+
+    dlo = dirty[k].address;
+    dhi = dlo + PIXELS_TO_BYTES_SPECIAL4(dirty[k].width * dirty[k].rows, dirty[k].size);
+    if (lo < dhi && dlo < hi)
+      dirty[k].lost = 1;
+  }
+}
+
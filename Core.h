@@ -86,6 +86,11 @@ typedef struct {
   int special_bsel0; 
   int special_bsel1;
   int rgb_alpha_dither;
+  int opaque_1cycle;
+  int early_z_1cycle;
+  int early_z_2cycle;
+  int zrun_1cycle;
+  int noise_draws;
 } MODEDERIVS;
 
 typedef struct {
@@ -128,15 +133,19 @@ typedef struct {
   MODEDERIVS f;
 } OTHER_MODES;
 
+/* Edge walker output for the 1024 span rows, one array per field, so the
+   walker stores and the renderers load only the fields they use. */
 typedef struct {
-  int lx, rx;
-  int unscrx;
-  int validline;
-  int32_t r, g, b, a, s, t, w, z;
-  int32_t majorx[4];
-  int32_t minorx[4];
-  int32_t invalyscan[4];
-} SPAN;
+  int lx[1024];
+  int rx[1024];
+  int unscrx[1024];
+  int validline[1024];
+  int32_t r[1024], g[1024], b[1024], a[1024];
+  int32_t s[1024], t[1024], w[1024], z[1024];
+  int32_t majorx[1024][4];
+  int32_t minorx[1024][4];
+  int32_t invalyscan[1024][4];
+} SPANBUF;
 
 typedef struct {
   int startspan;
@@ -147,9 +156,41 @@ typedef struct {
   int longspan;
 } SPANSIGS;
 
+typedef struct {
+  int32_t bound;
+  int32_t maxz;
+  uint32_t generation;
+  uint32_t primitive;
+  int loose;
+} HIZBLOCK;
+
+typedef struct {
+  uint32_t address;
+  int width;
+  int size;
+  int x0, y0, x1, y1;
+  int rows;
+  uint32_t stamp;
+  int lost;
+} DIRTYRECT;
+
+/* One table per ISA build of the span renderers; Core.c goes through
+   span_funcs. The SSE4.1 and AVX2 copies wrap the same inline bodies in
+   target attributes, so all of them share Core.c's state. */
+typedef struct {
+  void (*cycle1[3])(int, int, int, int);
+  void (*cycle1_opaque[3])(int, int, int, int);
+  void (*cycle2[4])(int, int, int, int);
+} SpanFuncTable;
+
+extern const SpanFuncTable SpanFuncs_base;
+extern const SpanFuncTable SpanFuncs_sse41;
+extern const SpanFuncTable SpanFuncs_avx2;
+extern const SpanFuncTable *span_funcs;
+
 extern uint32_t max_level;
 extern OTHER_MODES other_modes;
-extern SPAN span[1024];
+extern SPANBUF span;
 
 extern void (*tcdiv_ptr)(int32_t, int32_t, int32_t, int32_t*, int32_t*);
 
@@ -16,13 +16,16 @@
 #include "Random.h"
 
 /* Global data. */
+#if RDP_ISA == ISA_BASE
 int32_t noise;
+const DitherFuncTable *dither_funcs = &DitherFuncs_base;
+#endif
 
 /* DitherFuncs. */
 static void DitherComplete(int32_t *r, int32_t *g, int32_t *b, int32_t dither);
 static void DitherNothing(int32_t *r, int32_t *g, int32_t *b, int32_t dither) {}
 
-const DitherFunc DitherFuncLUT[2] = {
+static const DitherFunc ISA_NAME(DitherFuncLUT)[2] = {
   DitherComplete,
   DitherNothing
 };
@@ -33,12 +36,32 @@ static void DoDitherOnly(int32_t x, int32_t y, int32_t *cdith, int32_t *adith);
 static void DoDitherNothing(int32_t x, int32_t y, int32_t* cdith,
   int32_t* adith) {}
 
-const DitherNoiseFunc DitherNoiseFuncLUT[3] = {
+static const DitherNoiseFunc ISA_NAME(DitherNoiseFuncLUT)[3] = {
   DoDitherNoise,
   DoDitherOnly,
   DoDitherNothing
 };
 
+/* NOISE_HASHED variants: latch the pixel position for irand first. */
+static void DoDitherNoiseHashed(int32_t x, int32_t y, int32_t *cdith,
+  int32_t *adith);
+static void DoDitherOnlyHashed(int32_t x, int32_t y, int32_t *cdith,
+  int32_t *adith);
+static void DoDitherNothingHashed(int32_t x, int32_t y, int32_t *cdith,
+  int32_t *adith);
+
+static const DitherNoiseFunc ISA_NAME(DitherNoiseHashedFuncLUT)[3] = {
+  DoDitherNoiseHashed,
+  DoDitherOnlyHashed,
+  DoDitherNothingHashed
+};
+
+const DitherFuncTable ISA_NAME(DitherFuncs) = {
+  ISA_NAME(DitherFuncLUT),
+  ISA_NAME(DitherNoiseFuncLUT),
+  ISA_NAME(DitherNoiseHashedFuncLUT)
+};
+
 /* Magical LUTs. */
 static const uint8_t BayerMatrix[16] align(16) = {
   0, 4, 1, 5,
@@ -307,3 +330,20 @@ DoDitherOnly(int32_t x, int32_t y, int32_t* cdith, int32_t* adith) {
   }
 }
 
+static void
+DoDitherNoiseHashed(int32_t x, int32_t y, int32_t* cdith, int32_t* adith) {
+  noise_seek(x, y);
+  DoDitherNoise(x, y, cdith, adith);
+}
+
+static void
+DoDitherOnlyHashed(int32_t x, int32_t y, int32_t* cdith, int32_t* adith) {
+  noise_seek(x, y);
+  DoDitherOnly(x, y, cdith, adith);
+}
+
+static void
+DoDitherNothingHashed(int32_t x, int32_t y, int32_t* cdith,
+  int32_t* adith) {
+  noise_seek(x, y);
+}
@@ -17,8 +17,21 @@
 typedef void (*DitherFunc)(int32_t *, int32_t *, int32_t *, int32_t);
 typedef void (*DitherNoiseFunc)(int32_t, int32_t, int32_t *, int32_t *);
 
-extern const DitherFunc DitherFuncLUT[2];
-extern const DitherNoiseFunc DitherNoiseFuncLUT[3];
+/* One table per ISA build; callers go through dither_funcs. */
+typedef struct {
+  const DitherFunc *DitherFuncLUT;
+  const DitherNoiseFunc *DitherNoiseFuncLUT;
+  const DitherNoiseFunc *DitherNoiseHashedFuncLUT;
+} DitherFuncTable;
+
+extern const DitherFuncTable DitherFuncs_base;
+extern const DitherFuncTable DitherFuncs_sse41;
+extern const DitherFuncTable DitherFuncs_avx2;
+extern const DitherFuncTable *dither_funcs;
+
+#define DitherFuncLUT dither_funcs->DitherFuncLUT
+#define DitherNoiseFuncLUT dither_funcs->DitherNoiseFuncLUT
+#define DitherNoiseHashedFuncLUT dither_funcs->DitherNoiseHashedFuncLUT
 
 extern int32_t noise;
 
@@ -22,6 +22,10 @@
 #include <string.h>
 #endif
 
+#ifdef USE_SSE
+#include <tmmintrin.h>
+#endif
+
 #define GET_LOW(x) (((x) & 0x3E) << 2)
 #define GET_MED(x) (((x) & 0x7C0) >> 3)
 #define GET_HI(x)  (((x) >> 8) & 0xF8)
@@ -66,6 +70,41 @@ const FBWriteFunc FBWriteFuncLUT[4] = {
   FBWrite4, FBWrite8, FBWrite16, FBWrite32
 };
 
+/* FBExport functions. */
+static void FBExportRow8(uint32_t, uint32_t, uint8_t *, int);
+static void FBExportRow16(uint32_t, uint32_t, uint8_t *, int);
+static void FBExportRow32(uint32_t, uint32_t, uint8_t *, int);
+
+const FBExportFunc FBExportFuncLUT[4] = {
+  NULL, FBExportRow8, FBExportRow16, FBExportRow32
+};
+
+/* FBReadRow functions. */
+static void FBReadRow(uint32_t, uint32_t *);
+static void FBReadRow2(uint32_t, uint32_t *);
+
+const FBReadFunc FBReadRowFuncLUT[2] = {
+  FBReadRow, FBReadRow2
+};
+
+/* The unpacked row loaded by FBLoadRow16; lane i is pixel row_base + i. */
+static uint16_t row_r[FBROW_SIZE] align(16);
+static uint16_t row_g[FBROW_SIZE] align(16);
+static uint16_t row_b[FBROW_SIZE] align(16);
+static uint16_t row_a[FBROW_SIZE] align(16);
+static uint16_t row_cvg[FBROW_SIZE] align(16);
+static uint32_t row_base;
+
+/* FBWriteRun functions. */
+static void FBWriteRun4(uint32_t, uint32_t, const FBRUN *);
+static void FBWriteRun8(uint32_t, uint32_t, const FBRUN *);
+static void FBWriteRun16(uint32_t, uint32_t, const FBRUN *);
+static void FBWriteRun32(uint32_t, uint32_t, const FBRUN *);
+
+const FBWriteRunFunc FBWriteRunFuncLUT[4] = {
+  FBWriteRun4, FBWriteRun8, FBWriteRun16, FBWriteRun32
+};
+
 /* ============================================================================
  *  Memory access functions.
  * ========================================================================= */
@@ -268,6 +307,106 @@ FBRead2_32(uint32_t curpixel, uint32_t* curpixel_memcvg) {
     : 7;
 }
 
+/* ============================================================================
+ *  Row read functions: FBLoadRow16 unpacks a run of 16-bit pixels the way
+ *  FBRead_16 would, and FBReadRow/FBReadRow2 then serve reads from it.
+ * ========================================================================= */
+int
+FBLoadRow16(uint32_t base, uint32_t count) {
+  uint32_t address = fb_address + (base << 1);
+  uint32_t hidden = address >> 1;
+  uint32_t i, end = (count + 7) & ~7;
+
+  if (count > FBROW_SIZE || hidden + end >= sizeof(hidden_bits))
+    return 0;
+
+  row_base = base;
+
+#ifdef USE_SSE
+  __m128i f8 = _mm_set1_epi16(0xF8);
+  __m128i seven = _mm_set1_epi16(7);
+  __m128i fword, hbyte, r, g, b, lowbits;
+
+  for (i = 0; i < end; i += 8) {
+    fword = _mm_loadu_si128((__m128i *) (rdram_8 + address + (i << 1)));
+    fword = _mm_or_si128(_mm_slli_epi16(fword, 8), _mm_srli_epi16(fword, 8));
+    hbyte = _mm_loadl_epi64((__m128i *) (hidden_bits + hidden + i));
+    hbyte = _mm_unpacklo_epi8(hbyte, _mm_setzero_si128());
+
+    if (fb_format == FORMAT_RGBA) {
+      r = _mm_and_si128(_mm_srli_epi16(fword, 8), f8);
+      g = _mm_and_si128(_mm_srli_epi16(fword, 3), f8);
+      b = _mm_and_si128(_mm_slli_epi16(fword, 2), f8);
+      lowbits = _mm_or_si128(hbyte, _mm_slli_epi16(
+        _mm_and_si128(fword, _mm_set1_epi16(1)), 2));
+    }
+
+    else {
+      r = g = b = _mm_srli_epi16(fword, 8);
+      lowbits = _mm_and_si128(_mm_srli_epi16(fword, 5), seven);
+    }
+
+    if (!other_modes.image_read_en)
+      lowbits = seven;
+
+    _mm_store_si128((__m128i *) (row_r + i), r);
+    _mm_store_si128((__m128i *) (row_g + i), g);
+    _mm_store_si128((__m128i *) (row_b + i), b);
+    _mm_store_si128((__m128i *) (row_a + i), _mm_slli_epi16(lowbits, 5));
+    _mm_store_si128((__m128i *) (row_cvg + i), lowbits);
+  }
+#else
+  uint16_t fword;
+  uint8_t hbyte, lowbits;
+
+  for (i = 0; i < count; i++) {
+    RDRAMRead16H(address + (i << 1), &fword, &hbyte);
+
+    if (fb_format == FORMAT_RGBA) {
+      row_r[i] = GET_HI(fword);
+      row_g[i] = GET_MED(fword);
+      row_b[i] = GET_LOW(fword);
+      lowbits = ((fword & 1) << 2) | hbyte;
+    }
+
+    else {
+      row_r[i] = row_g[i] = row_b[i] = fword >> 8;
+      lowbits = (fword >> 5) & 7;
+    }
+
+    if (!other_modes.image_read_en)
+      lowbits = 7;
+
+    row_a[i] = lowbits << 5;
+    row_cvg[i] = lowbits;
+  }
+#endif
+
+  return 1;
+}
+
+static void
+FBReadRow(uint32_t curpixel, uint32_t* curpixel_memcvg) {
+  uint32_t i = curpixel - row_base;
+
+  memory_color.r = row_r[i];
+  memory_color.g = row_g[i];
+  memory_color.b = row_b[i];
+  memory_color.a = row_a[i];
+  *curpixel_memcvg = row_cvg[i];
+}
+
+static void
+FBReadRow2(uint32_t curpixel, uint32_t* curpixel_memcvg) {
+  uint32_t i = curpixel - row_base;
+
+  pre_memory_color.r = row_r[i];
+  pre_memory_color.g = row_g[i];
+  pre_memory_color.b = row_b[i];
+  pre_memory_color.a = row_a[i];
+  *curpixel_memcvg = row_cvg[i];
+}
+
 /* ============================================================================
  *  Framebuffer write functions.
  * ========================================================================= */
@@ -328,3 +467,279 @@ static void FBWrite32(uint32_t curpixel, uint32_t r, uint32_t g, uint32_t b,
   PAIRWRITE32(fb, finalcolor, (g & 1) ? 3 : 0, 0);
 }
 
+/* ============================================================================
+ *  Framebuffer run write functions: store the lanes of an FBRUN selected by
+ *  mask, with the same results as calling FBWrite on each pixel in turn.
+ * ========================================================================= */
+static void
+FBWriteRunEach(uint32_t base, uint32_t mask,
+  const FBRUN *run, FBWriteFunc write) {
+  uint32_t i;
+
+  while (mask) {
+    i = __builtin_ctz(mask);
+    mask &= mask - 1;
+
+    write(base + i, run->r[i], run->g[i], run->b[i],
+      run->blend_en[i], run->cvg[i], run->memcvg[i]);
+  }
+}
+
+static void
+FBWriteRun4(uint32_t base, uint32_t mask, const FBRUN *run) {
+  FBWriteRunEach(base, mask, run, FBWrite4);
+}
+
+static void
+FBWriteRun8(uint32_t base, uint32_t mask, const FBRUN *run) {
+  FBWriteRunEach(base, mask, run, FBWrite8);
+}
+
+#ifdef USE_SSE
+/* Per-lane store masks for the eight pixels whose bits are set in mask. */
+static __m128i
+lane_mask_epi16(uint32_t mask) {
+  __m128i bits = _mm_setr_epi16(0x01, 0x02, 0x04, 0x08,
+    0x10, 0x20, 0x40, 0x80);
+
+  return _mm_cmpeq_epi16(_mm_and_si128(
+    _mm_set1_epi16(mask), bits), bits);
+}
+
+static __m128i
+blend_si128(__m128i sel, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(sel, a), _mm_andnot_si128(sel, b));
+}
+
+/* finalize_spanalpha for eight pixels. */
+static __m128i
+finalize_spanalpha_epi16(__m128i blend_en,
+  __m128i cvg, __m128i memcvg) {
+  __m128i seven = _mm_set1_epi16(7);
+  __m128i eight = _mm_set1_epi16(8);
+  __m128i sum = _mm_add_epi16(cvg, memcvg);
+  __m128i noblend, wide;
+
+  switch(other_modes.cvg_dest) {
+  case CVG_CLAMP:
+    noblend = _mm_cmpeq_epi16(blend_en, _mm_setzero_si128());
+    sum = blend_si128(noblend, _mm_sub_epi16(cvg, _mm_set1_epi16(1)), sum);
+    wide = _mm_cmpeq_epi16(_mm_and_si128(sum, eight), eight);
+    return _mm_and_si128(_mm_or_si128(sum, wide), seven);
+
+  case CVG_WRAP:
+    return _mm_and_si128(sum, seven);
+
+  case CVG_ZAP:
+    return seven;
+
+  default:
+    return memcvg;
+  }
+}
+#endif
+
+static void
+FBWriteRun16(uint32_t base, uint32_t mask, const FBRUN *run) {
+#ifdef USE_SSE
+  __m128i f8 = _mm_set1_epi16(0xF8);
+  __m128i r, g, b, finalcvg, rval, hval, sel, old;
+  uint32_t fb, half, o;
+
+  for (o = 0; o < FBRUN_SIZE; o += 8) {
+    if (!(half = (mask >> o) & 0xFF))
+      continue;
+
+    fb = (fb_address >> 1) + base + o;
+    if (fb > sizeof(hidden_bits) - 8) {
+      FBWriteRunEach(base, half << o, run, FBWrite16);
+      continue;
+    }
+
+    r = _mm_load_si128((__m128i *) (run->r + o));
+    finalcvg = finalize_spanalpha_epi16(
+      _mm_load_si128((__m128i *) (run->blend_en + o)),
+      _mm_load_si128((__m128i *) (run->cvg + o)),
+      _mm_load_si128((__m128i *) (run->memcvg + o)));
+
+    if (fb_format == FORMAT_RGBA) {
+      g = _mm_load_si128((__m128i *) (run->g + o));
+      b = _mm_load_si128((__m128i *) (run->b + o));
+
+      rval = _mm_or_si128(_mm_or_si128(
+        _mm_slli_epi16(_mm_and_si128(r, f8), 8),
+        _mm_slli_epi16(_mm_and_si128(g, f8), 3)),
+        _mm_srli_epi16(_mm_and_si128(b, f8), 2));
+      rval = _mm_or_si128(rval, _mm_srli_epi16(finalcvg, 2));
+      hval = _mm_and_si128(finalcvg, _mm_set1_epi16(3));
+    }
+
+    else {
+      rval = _mm_or_si128(_mm_slli_epi16(r, 8), _mm_slli_epi16(finalcvg, 5));
+      hval = _mm_setzero_si128();
+    }
+
+    /* RDRAM holds big-endian halfwords. */
+    rval = _mm_or_si128(_mm_slli_epi16(rval, 8), _mm_srli_epi16(rval, 8));
+    sel = lane_mask_epi16(half);
+
+    old = _mm_loadu_si128((__m128i *) (rdram_16 + fb));
+    _mm_storeu_si128((__m128i *) (rdram_16 + fb), blend_si128(sel, rval, old));
+
+    hval = _mm_packus_epi16(hval, hval);
+    sel = _mm_packs_epi16(sel, sel);
+    old = _mm_loadl_epi64((__m128i *) (hidden_bits + fb));
+    _mm_storel_epi64((__m128i *) (hidden_bits + fb), blend_si128(sel, hval, old));
+  }
+#else
+  FBWriteRunEach(base, mask, run, FBWrite16);
+#endif
+}
+
+static void
+FBWriteRun32(uint32_t base, uint32_t mask, const FBRUN *run) {
+#ifdef USE_SSE
+  __m128i ff = _mm_set1_epi16(0xFF);
+  __m128i zero = _mm_setzero_si128();
+  __m128i r, g, b, c, rg, bc, hval, sel, old;
+  uint32_t fb, half, o;
+
+  for (o = 0; o < FBRUN_SIZE; o += 8) {
+    if (!(half = (mask >> o) & 0xFF))
+      continue;
+
+    fb = (fb_address >> 2) + base + o;
+    if (fb > (sizeof(hidden_bits) >> 1) - 8) {
+      FBWriteRunEach(base, half << o, run, FBWrite32);
+      continue;
+    }
+
+    r = _mm_load_si128((__m128i *) (run->r + o));
+    g = _mm_load_si128((__m128i *) (run->g + o));
+    b = _mm_load_si128((__m128i *) (run->b + o));
+    c = _mm_slli_epi16(finalize_spanalpha_epi16(
+      _mm_load_si128((__m128i *) (run->blend_en + o)),
+      _mm_load_si128((__m128i *) (run->cvg + o)),
+      _mm_load_si128((__m128i *) (run->memcvg + o))), 5);
+
+    /* Interleave to the big-endian byte order of each word: r, g, b, cvg. */
+    r = _mm_packus_epi16(_mm_and_si128(r, ff), zero);
+    hval = _mm_and_si128(g, _mm_set1_epi16(1));
+    g = _mm_packus_epi16(_mm_and_si128(g, ff), zero);
+    b = _mm_packus_epi16(_mm_and_si128(b, ff), zero);
+    c = _mm_packus_epi16(c, zero);
+    rg = _mm_unpacklo_epi8(r, g);
+    bc = _mm_unpacklo_epi8(b, c);
+
+    sel = lane_mask_epi16(half);
+    old = _mm_loadu_si128((__m128i *) (rdram + fb));
+    _mm_storeu_si128((__m128i *) (rdram + fb), blend_si128(
+      _mm_unpacklo_epi16(sel, sel), _mm_unpacklo_epi16(rg, bc), old));
+    old = _mm_loadu_si128((__m128i *) (rdram + fb + 4));
+    _mm_storeu_si128((__m128i *) (rdram + fb + 4), blend_si128(
+      _mm_unpackhi_epi16(sel, sel), _mm_unpackhi_epi16(rg, bc), old));
+
+    /* Each pixel owns two hidden bytes: 3 if g is odd, then 0. */
+    hval = _mm_or_si128(hval, _mm_slli_epi16(hval, 1));
+    old = _mm_loadu_si128((__m128i *) (hidden_bits + (fb << 1)));
+    _mm_storeu_si128((__m128i *) (hidden_bits + (fb << 1)),
+      blend_si128(sel, hval, old));
+  }
+#else
+  FBWriteRunEach(base, mask, run, FBWrite32);
+#endif
+}
+
+/* ============================================================================
+ *  Framebuffer export functions: convert count pixels at RDRAM address to
+ *  host 32-bit pixels, with the colour and alpha the FBRead functions give
+ *  under image_read_en.
+ * ========================================================================= */
+static void
+FBExportRow8(uint32_t address, uint32_t count, uint8_t *dst, int layout) {
+  uint32_t i;
+
+  for (i = 0; i < count; i++, dst += 4) {
+    dst[0] = dst[1] = dst[2] = rdram_8[address + i];
+    dst[3] = 0xE0;
+  }
+}
+
+static void
+FBExportRow16(uint32_t address, uint32_t count, uint8_t *dst, int layout) {
+  uint32_t i = 0;
+  uint16_t fword;
+  uint8_t hbyte, r, b;
+
+#ifdef USE_SSE
+  __m128i f8 = _mm_set1_epi16(0xF8);
+  __m128i ff = _mm_set1_epi16(0xFF);
+  __m128i fword8, hbyte8, r8, g8, b8, a8, lo, hi;
+
+  for (; i + 8 <= count; i += 8, dst += 32) {
+    fword8 = _mm_loadu_si128((__m128i *) (rdram_8 + address + (i << 1)));
+    fword8 = _mm_or_si128(_mm_slli_epi16(fword8, 8), _mm_srli_epi16(fword8, 8));
+    hbyte8 = _mm_loadl_epi64((__m128i *) (hidden_bits + (address >> 1) + i));
+    hbyte8 = _mm_unpacklo_epi8(hbyte8, _mm_setzero_si128());
+
+    r8 = _mm_and_si128(_mm_srli_epi16(fword8, 8), f8);
+    g8 = _mm_and_si128(_mm_srli_epi16(fword8, 3), f8);
+    b8 = _mm_and_si128(_mm_slli_epi16(fword8, 2), f8);
+    a8 = _mm_and_si128(_mm_slli_epi16(_mm_or_si128(hbyte8, _mm_slli_epi16(
+      _mm_and_si128(fword8, _mm_set1_epi16(1)), 2)), 5), ff);
+
+    if (layout == EXPORT_BGRA8888) {
+      lo = _mm_or_si128(b8, _mm_slli_epi16(g8, 8));
+      hi = _mm_or_si128(r8, _mm_slli_epi16(a8, 8));
+    }
+
+    else {
+      lo = _mm_or_si128(r8, _mm_slli_epi16(g8, 8));
+      hi = _mm_or_si128(b8, _mm_slli_epi16(a8, 8));
+    }
+
+    _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(lo, hi));
+    _mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi16(lo, hi));
+  }
+#endif
+
+  for (; i < count; i++, dst += 4) {
+    RDRAMRead16H(address + (i << 1), &fword, &hbyte);
+    r = GET_HI(fword);
+    b = GET_LOW(fword);
+
+    dst[0] = (layout == EXPORT_BGRA8888) ? b : r;
+    dst[1] = GET_MED(fword);
+    dst[2] = (layout == EXPORT_BGRA8888) ? r : b;
+    dst[3] = (((fword & 1) << 2) | hbyte) << 5;
+  }
+}
+
+static void
+FBExportRow32(uint32_t address, uint32_t count, uint8_t *dst, int layout) {
+  uint32_t i = 0;
+  uint8_t buffer[4];
+
+#ifdef USE_SSE
+  __m128i amask = _mm_set1_epi32(0xE0FFFFFF);
+  __m128i swap = (layout == EXPORT_BGRA8888)
+    ? _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15)
+    : _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i pixels;
+
+  for (; i + 4 <= count; i += 4, dst += 16) {
+    pixels = _mm_loadu_si128((__m128i *) (rdram_8 + address + (i << 2)));
+    pixels = _mm_shuffle_epi8(_mm_and_si128(pixels, amask), swap);
+    _mm_storeu_si128((__m128i *) dst, pixels);
+  }
+#endif
+
+  for (; i < count; i++, dst += 4) {
+    RDRAMRead32(address + (i << 2), buffer);
+    dst[0] = buffer[(layout == EXPORT_BGRA8888) ? 2 : 0];
+    dst[1] = buffer[1];
+    dst[2] = buffer[(layout == EXPORT_BGRA8888) ? 0 : 2];
+    dst[3] = buffer[3] & 0xE0;
+  }
+}
+
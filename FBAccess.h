@@ -33,13 +33,41 @@ extern int32_t fb_format;
 
 extern uint8_t hidden_bits[0x400000];
 
+/* A window of FBRUN_SIZE adjacent pixels waiting to be written; lane i
+ * holds pixel base + i, and only the lanes set in the write mask are valid. */
+#define FBRUN_SIZE 16
+
+typedef struct {
+  uint16_t r[FBRUN_SIZE];
+  uint16_t g[FBRUN_SIZE];
+  uint16_t b[FBRUN_SIZE];
+  uint16_t blend_en[FBRUN_SIZE];
+  uint16_t cvg[FBRUN_SIZE];
+  uint16_t memcvg[FBRUN_SIZE];
+} FBRUN;
+
 typedef void (*FBReadFunc)(uint32_t, uint32_t *);
 typedef void (*FBWriteFunc)(uint32_t, uint32_t,
   uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+typedef void (*FBWriteRunFunc)(uint32_t, uint32_t, const FBRUN *);
 
 extern const FBReadFunc FBReadFuncLUT[4];
 extern const FBReadFunc FBReadFunc2LUT[4];
 extern const FBWriteFunc FBWriteFuncLUT[4];
+extern const FBWriteRunFunc FBWriteRunFuncLUT[4];
+extern const FBReadFunc FBReadRowFuncLUT[2];
+
+/* Host pixel layouts for RDPExportFramebuffer, byte order in memory. */
+#define EXPORT_RGBA8888 0
+#define EXPORT_BGRA8888 1
+
+typedef void (*FBExportFunc)(uint32_t, uint32_t, uint8_t *, int);
+extern const FBExportFunc FBExportFuncLUT[4];
+
+/* Longest row FBLoadRow16 can hold. */
+#define FBROW_SIZE 1024
+
+int FBLoadRow16(uint32_t base, uint32_t count);
 
 #endif
 
@@ -43,14 +43,22 @@ _mm_mullo_epi32(__m128i a, __m128i b) {
 /* ============================================================================
  *  Global look-up tables.
  * ========================================================================= */
+#if RDP_ISA == ISA_BASE
 const int32_t FlipLUT[2] = {-1, 1};
+const HelperFuncTable *helper_funcs = &HelperFuncs_base;
+#endif
 
 /* ============================================================================
  *  AddVectors: Sums up all pairs of values in a vector.
  * ========================================================================= */
-void
-AddVectors(int32_t *dest, const int32_t *srca, const int32_t *srcb) {
-#ifdef USE_SSE
+static void
+ISA_NAME(AddVectors)(int32_t *dest, const int32_t *srca, const int32_t *srcb) {
+#if defined(USE_SSE) && RDP_ISA == ISA_AVX2
+  __m256i srca8 = _mm256_loadu_si256((__m256i*) srca);
+  __m256i srcb8 = _mm256_loadu_si256((__m256i*) srcb);
+
+  _mm256_storeu_si256((__m256i*) dest, _mm256_add_epi32(srca8, srcb8));
+#elif defined(USE_SSE)
   __m128i srca1 = _mm_load_si128((__m128i*) (srca + 0));
   __m128i srca2 = _mm_load_si128((__m128i*) (srca + 4));
   __m128i srcb1 = _mm_load_si128((__m128i*) (srcb + 0));
@@ -77,13 +85,19 @@ AddVectors(int32_t *dest, const int32_t *srca, const int32_t *srcb) {
 /* ============================================================================
  *  ASR8ClearLow: Performs an arithmetic right shift by 8, clears low bit.
  * ========================================================================= */
-void
-ASR8ClearLow(int32_t *dest, const int32_t *src) {
+static void
+ISA_NAME(ASR8ClearLow)(int32_t *dest, const int32_t *src) {
   static int32_t DataVector[4] align(16) = {
     ~1, ~1, ~1, ~1,
   };
 
-#ifdef USE_SSE
+#if defined(USE_SSE) && RDP_ISA == ISA_AVX2
+  __m256i mask = _mm256_set1_epi32(DataVector[0]);
+  __m256i src8 = _mm256_loadu_si256((__m256i*) src);
+
+  src8 = _mm256_and_si256(_mm256_srai_epi32(src8, 8), mask);
+  _mm256_storeu_si256((__m256i*) dest, src8);
+#elif defined(USE_SSE)
   __m128i mask = _mm_load_si128((__m128i*) (DataVector));
   __m128i src1 = _mm_load_si128((__m128i*) (src + 0));
   __m128i src2 = _mm_load_si128((__m128i*) (src + 4));
@@ -110,13 +124,18 @@ ASR8ClearLow(int32_t *dest, const int32_t *src) {
 /* ============================================================================
  *  ClearLow5: Clears the least significant 5 bits within a vector.
  * ========================================================================= */
-void
-ClearLow5(int32_t *dest, const int32_t *src) {
+static void
+ISA_NAME(ClearLow5)(int32_t *dest, const int32_t *src) {
   static int32_t DataVector[4] align(16) = {
     ~0x1F, ~0x1F, ~0x1F, ~0x1F,
   };
 
-#ifdef USE_SSE
+#if defined(USE_SSE) && RDP_ISA == ISA_AVX2
+  __m256i mask = _mm256_set1_epi32(DataVector[0]);
+  __m256i src8 = _mm256_loadu_si256((__m256i*) src);
+
+  _mm256_storeu_si256((__m256i*) dest, _mm256_and_si256(src8, mask));
+#elif defined(USE_SSE)
   __m128i mask = _mm_load_si128((__m128i*) (DataVector));
   __m128i src1 = _mm_load_si128((__m128i*) (src + 0));
   __m128i src2 = _mm_load_si128((__m128i*) (src + 4));
@@ -141,13 +160,18 @@ ClearLow5(int32_t *dest, const int32_t *src) {
 /* ============================================================================
  *  ClearLow9: Clears the least significant 5 bits within a vector.
  * ========================================================================= */
-void
-ClearLow9(int32_t *dest, const int32_t *src) {
+static void
+ISA_NAME(ClearLow9)(int32_t *dest, const int32_t *src) {
   static int32_t DataVector[4] align(16) = {
     ~0x1FF, ~0x1FF, ~0x1FF, ~0x1FF,
   };
 
-#ifdef USE_SSE
+#if defined(USE_SSE) && RDP_ISA == ISA_AVX2
+  __m256i mask = _mm256_set1_epi32(DataVector[0]);
+  __m256i src8 = _mm256_loadu_si256((__m256i*) src);
+
+  _mm256_storeu_si256((__m256i*) dest, _mm256_and_si256(src8, mask));
+#elif defined(USE_SSE)
   __m128i mask = _mm_load_si128((__m128i*) (DataVector));
   __m128i src1 = _mm_load_si128((__m128i*) (src + 0));
   __m128i src2 = _mm_load_si128((__m128i*) (src + 4));
@@ -172,9 +196,16 @@ ClearLow9(int32_t *dest, const int32_t *src) {
 /* ============================================================================
  *  DiffASR2: Computes the difference, and subs (diff shift arith right by two).
  * ========================================================================= */
-void
-DiffASR2(int32_t *dest, const int32_t *srca, const int32_t *srcb) {
-#ifdef USE_SSE
+static void
+ISA_NAME(DiffASR2)(int32_t *dest, const int32_t *srca, const int32_t *srcb) {
+#if defined(USE_SSE) && RDP_ISA == ISA_AVX2
+  __m256i srca8 = _mm256_loadu_si256((__m256i*) srca);
+  __m256i srcb8 = _mm256_loadu_si256((__m256i*) srcb);
+  __m256i dest8 = _mm256_sub_epi32(srca8, srcb8);
+
+  dest8 = _mm256_sub_epi32(dest8, _mm256_srai_epi32(dest8, 2));
+  _mm256_storeu_si256((__m256i*) dest, dest8);
+#elif defined(USE_SSE)
   __m128i srca1 = _mm_load_si128((__m128i*) (srca + 0));
   __m128i srca2 = _mm_load_si128((__m128i*) (srca + 4));
   __m128i srcb1 = _mm_load_si128((__m128i*) (srcb + 0));
@@ -213,8 +244,8 @@ DiffASR2(int32_t *dest, const int32_t *srca, const int32_t *srcb) {
 /* ============================================================================
  *  FlipSigns: Conditionally flips the sign of 8 int32_ts according to flip.
  * ========================================================================= */
-void
-FlipSigns(int32_t *dest, const int32_t *src, unsigned flip) {
+static void
+ISA_NAME(FlipSigns)(int32_t *dest, const int32_t *src, unsigned flip) {
   assert((flip & 1) == flip);
 
   static int32_t FlipVector[2][4] align(16) = {
@@ -222,7 +253,12 @@ FlipSigns(int32_t *dest, const int32_t *src, unsigned flip) {
     { 1,  1,  1,  1},
   };
 
-#ifdef USE_SSE
+#if defined(USE_SSE) && RDP_ISA == ISA_AVX2
+  __m256i sign = _mm256_set1_epi32(FlipVector[flip][0]);
+  __m256i spans8 = _mm256_loadu_si256((__m256i*) src);
+
+  _mm256_storeu_si256((__m256i*) dest, _mm256_sign_epi32(spans8, sign));
+#elif defined(USE_SSE)
   __m128i sign   = _mm_load_si128((__m128i*) (FlipVector[flip]));
   __m128i spans1 = _mm_load_si128((__m128i*) (src + 0));
   __m128i spans2 = _mm_load_si128((__m128i*) (src + 4));
@@ -251,9 +287,35 @@ FlipSigns(int32_t *dest, const int32_t *src, unsigned flip) {
 /* ============================================================================
  *  LoadEWPrimData: Loads data for edgewalker_for_prims().
  * ========================================================================= */
-void
-LoadEWPrimData(int32_t *dest1, int32_t *dest2, const int32_t *src) {
-#ifdef USE_SSE
+static void
+ISA_NAME(LoadEWPrimData)(int32_t *dest1, int32_t *dest2, const int32_t *src) {
+#if defined(USE_SSE) && RDP_ISA == ISA_AVX2
+  static const uint8_t ewShuffleData[16] align(16) = {
+    0xA,0xB,0x2,0x3,
+    0x8,0x9,0x0,0x1,
+    0xE,0xF,0x6,0x7,
+    0xC,0xD,0x4,0x5,
+  };
+
+  __m256i ewShuffleKey = _mm256_broadcastsi128_si256(
+    _mm_load_si128((__m128i*) (ewShuffleData)));
+  __m256i ewData1, ewData2, ewDataLo, ewDataHi;
+
+  /* Words 0-7 in the low lanes, words 16-23 in the high lanes. */
+  ewData1 = _mm256_inserti128_si256(_mm256_castsi128_si256(
+    _mm_load_si128((__m128i*) (src + 0))),
+    _mm_load_si128((__m128i*) (src + 16)), 1);
+  ewData2 = _mm256_inserti128_si256(_mm256_castsi128_si256(
+    _mm_load_si128((__m128i*) (src + 4))),
+    _mm_load_si128((__m128i*) (src + 20)), 1);
+
+  ewDataLo = _mm256_unpacklo_epi64(ewData1, ewData2);
+  ewDataHi = _mm256_unpackhi_epi64(ewData1, ewData2);
+  ewDataLo = _mm256_shuffle_epi8(ewDataLo, ewShuffleKey);
+  ewDataHi = _mm256_shuffle_epi8(ewDataHi, ewShuffleKey);
+  _mm256_storeu_si256((__m256i*) dest1, ewDataLo);
+  _mm256_storeu_si256((__m256i*) dest2, ewDataHi);
+#elif defined(USE_SSE)
   __m128i ewShuffleKey;
   __m128i ewData1, ewData2;
   __m128i ewDataLo, ewDataHi;
@@ -307,9 +369,15 @@ LoadEWPrimData(int32_t *dest1, int32_t *dest2, const int32_t *src) {
 /* ============================================================================
  *  MulConstant: Multiplies a vector by a constant value.
  * ========================================================================= */
-void
-MulConstant(int32_t *dest, int32_t *src, int32_t constant) {
-#ifdef USE_SSE
+static void
+ISA_NAME(MulConstant)(int32_t *dest, int32_t *src, int32_t constant) {
+#if defined(USE_SSE) && RDP_ISA == ISA_AVX2
+  __m256i constantVector = _mm256_set1_epi32(constant);
+  __m256i src8 = _mm256_loadu_si256((__m256i*) src);
+
+  src8 = _mm256_mullo_epi32(src8, constantVector);
+  _mm256_storeu_si256((__m256i*) dest, src8);
+#elif defined(USE_SSE)
   __m128i constantVector;
   __m128i src1, src2;
 
@@ -332,3 +400,13 @@ MulConstant(int32_t *dest, int32_t *src, int32_t constant) {
 #endif
 }
 
+const HelperFuncTable ISA_NAME(HelperFuncs) = {
+  ISA_NAME(AddVectors),
+  ISA_NAME(ASR8ClearLow),
+  ISA_NAME(ClearLow5),
+  ISA_NAME(ClearLow9),
+  ISA_NAME(DiffASR2),
+  ISA_NAME(FlipSigns),
+  ISA_NAME(LoadEWPrimData),
+  ISA_NAME(MulConstant)
+};
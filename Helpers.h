@@ -13,7 +13,9 @@
 #include "Common.h"
 
 #ifdef USE_SSE
-#ifdef SSSE3_ONLY
+#if RDP_ISA == ISA_AVX2
+#include <immintrin.h>
+#elif defined(SSSE3_ONLY)
 #include <tmmintrin.h>
 #else
 #include <smmintrin.h>
@@ -22,15 +24,31 @@
 
 extern const int32_t FlipLUT[2];
 
-void AddVectors(int32_t *dest, const int32_t *srca, const int32_t *srcb);
-void ASR8ClearLow(int32_t *dest, const int32_t *src);
-__m128i BroadcastInt(int32_t constant);
-void ClearLow5(int32_t *dest, const int32_t *src);
-void ClearLow9(int32_t *dest, const int32_t *src);
-void DiffASR2(int32_t *dest, const int32_t *srca, const int32_t *srcb);
-void FlipSigns(int32_t *dest, const int32_t *src, unsigned flip);
-void LoadEWPrimData(int32_t *dest1, int32_t *dest2, const int32_t *src);
-void MulConstant(int32_t *dest, int32_t *src, int32_t constant);
+/* One table per ISA build; callers go through helper_funcs. */
+typedef struct {
+  void (*AddVectors)(int32_t *dest, const int32_t *srca, const int32_t *srcb);
+  void (*ASR8ClearLow)(int32_t *dest, const int32_t *src);
+  void (*ClearLow5)(int32_t *dest, const int32_t *src);
+  void (*ClearLow9)(int32_t *dest, const int32_t *src);
+  void (*DiffASR2)(int32_t *dest, const int32_t *srca, const int32_t *srcb);
+  void (*FlipSigns)(int32_t *dest, const int32_t *src, unsigned flip);
+  void (*LoadEWPrimData)(int32_t *dest1, int32_t *dest2, const int32_t *src);
+  void (*MulConstant)(int32_t *dest, int32_t *src, int32_t constant);
+} HelperFuncTable;
+
+extern const HelperFuncTable HelperFuncs_base;
+extern const HelperFuncTable HelperFuncs_sse41;
+extern const HelperFuncTable HelperFuncs_avx2;
+extern const HelperFuncTable *helper_funcs;
+
+#define AddVectors helper_funcs->AddVectors
+#define ASR8ClearLow helper_funcs->ASR8ClearLow
+#define ClearLow5 helper_funcs->ClearLow5
+#define ClearLow9 helper_funcs->ClearLow9
+#define DiffASR2 helper_funcs->DiffASR2
+#define FlipSigns helper_funcs->FlipSigns
+#define LoadEWPrimData helper_funcs->LoadEWPrimData
+#define MulConstant helper_funcs->MulConstant
 
 #endif
 
@@ -15,5 +15,14 @@
 int DPRegRead(void *, uint32_t, void *);
 int DPRegWrite(void *, uint32_t, void *);
 
+/* Must be called whenever anything but the RDP writes RDRAM. */
+void RDPInvalidateRDRAM(uint32_t address, uint32_t length);
+
+/* Off by default. Both cache the Z image, so a host that turns one on has
+   to call RDPInvalidateRDRAM for every CPU, DMA or RSP write to RDRAM. */
+void RDPSetCoarseZ(int enable);
+void RDPSetZMirror(int enable);
+void RDPFlushRDRAM(void);
+
 #endif
 
@@ -15,12 +15,91 @@
 
 /* Global data. */
 int32_t iseed = 1;
+int noise_source = NOISE_SERIAL;
+
+static uint32_t noise_frame, noise_primitive;
+static uint32_t noise_x, noise_y, noise_draw;
+
+/* 32-bit avalanche mixer (two multiply-xorshift rounds). */
+static uint32_t
+noise_mix(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x7FEB352D;
+  h ^= h >> 15;
+  h *= 0x846CA68B;
+  h ^= h >> 16;
+
+  return h;
+}
+
+/* Hashed noise: a pure function of the pixel position, the draw index
+ * within that pixel, and the frame and primitive counters. Unlike the
+ * LCG, it does not depend on the order in which pixels are shaded. */
+static int32_t
+hrand() {
+  uint32_t key = noise_mix(noise_primitive ^ noise_mix(noise_frame));
+  uint32_t pos = (noise_x & 0xFFF) | ((noise_y & 0xFFF) << 12) |
+    ((noise_draw++ & 0xFF) << 24);
+
+  return noise_mix(pos ^ key) & 0x7FFF;
+}
 
 int32_t
 irand() {
+  if (noise_source == NOISE_HASHED)
+    return hrand();
+
   iseed *= 0x343FD;
   iseed += 0x269EC3;
 
   return ((iseed >> 16) & 0x7FFF);
 }
 
+/* The LCG state after n further draws from seed. Each step is the affine
+ * map x -> a*x + c, so n steps are that map raised to the n-th power,
+ * built by squaring. (The closed form c*(a^n - 1)/(a - 1) is unusable
+ * mod 2^32, as a - 1 is even.) */
+int32_t
+irand_seed_after(int32_t seed, uint32_t n) {
+  uint32_t a = 0x343FD, c = 0x269EC3;
+  uint32_t an = 1, cn = 0;
+
+  for (; n; n >>= 1) {
+    if (n & 1) {
+      an *= a;
+      cn = cn * a + c;
+    }
+
+    c *= a + 1;
+    a *= a;
+  }
+
+  return (int32_t) (an * (uint32_t) seed + cn);
+}
+
+/* Advances the serial sequence as if irand() had been called n times.
+ * Hashed draws carry no state between pixels, so there is nothing to do. */
+void
+irand_skip(uint32_t n) {
+  if (noise_source == NOISE_SERIAL && n)
+    iseed = irand_seed_after(iseed, n);
+}
+
+void
+noise_next_frame() {
+  noise_frame++;
+  noise_primitive = 0;
+}
+
+void
+noise_next_primitive() {
+  noise_primitive++;
+}
+
+void
+noise_seek(int32_t x, int32_t y) {
+  noise_x = x;
+  noise_y = y;
+  noise_draw = 0;
+}
+
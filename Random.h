@@ -14,6 +14,20 @@
 #define __RANDOM_H__
 #include "Common.h"
 
+/* NOISE_SERIAL is the hardware-order LCG; NOISE_HASHED derives each draw
+ * from the pixel position set by noise_seek and is order-independent. */
+enum NoiseSource {
+  NOISE_SERIAL,
+  NOISE_HASHED
+};
+
+extern int noise_source;
+
 int32_t irand();
+int32_t irand_seed_after(int32_t seed, uint32_t n);
+void irand_skip(uint32_t n);
+void noise_next_frame();
+void noise_next_primitive();
+void noise_seek(int32_t x, int32_t y);
 
 #endif
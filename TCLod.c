@@ -22,7 +22,12 @@
 #endif
 #endif
 
-int32_t tclod_tcclamp(int32_t x) {
+#if RDP_ISA == ISA_BASE
+const TCLodFuncTable *tclod_funcs = &TCLodFuncs_base;
+#endif
+
+static int32_t
+ISA_NAME(tclod_tcclamp)(int32_t x) {
   static const uint32_t LUT2[4] align(16) = {
     0x0000, 0x7FFF, 0x8000, 0x0000,
   };
@@ -47,7 +52,8 @@ int32_t tclod_tcclamp(int32_t x) {
   return LUT2[idx];
 }
 
-void tclod_1cycle_current_simple(int32_t* sss, int32_t* sst,
+static void
+ISA_NAME(tclod_1cycle_current_simple)(int32_t* sss, int32_t* sst,
   const int32_t *spanptr, const int32_t *dincs, int32_t scanline,
   int32_t prim_tile, int32_t* t1, const SPANSIGS* sigs) {
   int32_t nexts, nextt, nextsw;
@@ -67,13 +73,13 @@ void tclod_1cycle_current_simple(int32_t* sss, int32_t* sst,
 
   stw = _mm_load_si128((__m128i*) spanptr);
   dincstw = _mm_load_si128((__m128i*) dincs);
-  *sss = tclod_tcclamp(*sss);
-  *sst = tclod_tcclamp(*sst);
+  *sss = ISA_NAME(tclod_tcclamp)(*sss);
+  *sst = ISA_NAME(tclod_tcclamp)(*sst);
 
   if (!other_modes.f.dolod)
     return;
 
-  if (span[nextscan].validline) {
+  if (span.validline[nextscan]) {
     if (!sigs->endspan || !sigs->longspan) {
       nextstw = _mm_add_epi32(stw, dincstw);
       nextstw = _mm_srai_epi32(nextstw, 16);
@@ -92,7 +98,7 @@ void tclod_1cycle_current_simple(int32_t* sss, int32_t* sst,
     }
 
     else {
-      __m128i temp = _mm_loadu_si128((__m128i*) &span[nextscan].s);
+      __m128i temp = _mm_setr_epi32(span.s[nextscan], span.t[nextscan], span.w[nextscan], span.z[nextscan]);
 
       nextstw = _mm_srai_epi32(temp, 16);
       farstw = _mm_add_epi32(temp, dincstw);
@@ -141,3 +147,7 @@ void tclod_1cycle_current_simple(int32_t* sss, int32_t* sst,
   }
 }
 
+const TCLodFuncTable ISA_NAME(TCLodFuncs) = {
+  ISA_NAME(tclod_tcclamp),
+  ISA_NAME(tclod_1cycle_current_simple)
+};
@@ -15,7 +15,21 @@
 #include "Common.h"
 #include "Core.h"
 
-int32_t tclod_tcclamp(int32_t x);
+/* One table per ISA build; callers go through tclod_funcs. */
+typedef struct {
+  int32_t (*tclod_tcclamp)(int32_t x);
+  void (*tclod_1cycle_current_simple)(int32_t* sss, int32_t* sst,
+    const int32_t *spanptr, const int32_t *dincs, int32_t scanline,
+    int32_t prim_tile, int32_t* t1, const SPANSIGS* sigs);
+} TCLodFuncTable;
+
+extern const TCLodFuncTable TCLodFuncs_base;
+extern const TCLodFuncTable TCLodFuncs_sse41;
+extern const TCLodFuncTable TCLodFuncs_avx2;
+extern const TCLodFuncTable *tclod_funcs;
+
+#define tclod_tcclamp tclod_funcs->tclod_tcclamp
+#define tclod_1cycle_current_simple tclod_funcs->tclod_1cycle_current_simple
 
 void tclod_4x17_to_15(int32_t scurr, int32_t snext,
   int32_t tcurr, int32_t tnext, int32_t previous, int32_t* lod);
@@ -23,9 +37,5 @@ void tclod_4x17_to_15(int32_t scurr, int32_t snext,
 void lodfrac_lodtile_signals(int lodclamp, int32_t lod,
   uint32_t* l_tile, uint32_t* magnify, uint32_t* distant);
 
-void tclod_1cycle_current_simple(int32_t* sss, int32_t* sst,
-  const int32_t *spanptr, const int32_t *dincs, int32_t scanline,
-  int32_t prim_tile, int32_t* t1, const SPANSIGS* sigs);
-
 #endif
 